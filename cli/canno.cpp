@@ -0,0 +1,294 @@
+// Headless batch evaluator: load a CSV and a formula overlay, recalculate, export ranges
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "Csv.hpp"
+#include "Server.hpp"
+#include "Sheet.hpp"
+#include "Trace.hpp"
+#include "Utils.hpp"
+
+struct Options {
+    std::string input;
+    std::string formulas;
+    std::string output;
+    std::string trace;
+    std::string serve;
+    std::vector<std::string> ranges;
+    bool quiet = false;
+};
+
+struct Range {
+    int first_col;
+    int first_row;
+    int last_col;
+    int last_row;
+};
+
+struct Assignment {
+    int col;
+    int row;
+    std::string value;
+};
+
+using Clock = std::chrono::steady_clock;
+
+static Server* active_server = nullptr;
+
+static void stop_server(int) {
+    if (active_server != nullptr) active_server->stop();
+}
+
+static void usage(std::ostream& out) {
+    out << "usage: canno [options] [RANGE...]\n"
+        << "  -i, --input FILE     CSV to load, the first field lands in A1\n"
+        << "  -f, --formulas FILE  overlay with one \"REF VALUE\" per line, e.g. \"C1 =SUM(A1:B1)\"\n"
+        << "  -o, --output FILE    write the ranges here instead of stdout\n"
+        << "  -t, --trace FILE     record a Chrome trace-event JSON of the run\n"
+        << "  -s, --serve SOCKET   keep the sheet and serve it on a Unix socket instead of exporting\n"
+        << "  -q, --quiet          do not report phase timings on stderr\n"
+        << "  RANGE                cells to export, e.g. A1:C10 (default: everything loaded)\n";
+}
+
+static std::optional<Options> parse_args(int argc, char** argv) {
+    Options opts;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto next = [&]() -> const char* { return i + 1 < argc ? argv[++i] : nullptr; };
+
+        if (arg == "-h" || arg == "--help") {
+            usage(std::cout);
+            std::exit(0);
+        } else if (arg == "-q" || arg == "--quiet") {
+            opts.quiet = true;
+        } else if (arg == "-i" || arg == "--input" || arg == "-f" || arg == "--formulas" || arg == "-o" ||
+                   arg == "--output" || arg == "-t" || arg == "--trace" || arg == "-s" || arg == "--serve") {
+            const char* val = next();
+            if (val == nullptr) {
+                std::cerr << "canno: " << arg << " needs a value\n";
+                return std::nullopt;
+            }
+            if (arg == "-i" || arg == "--input") opts.input = val;
+            if (arg == "-f" || arg == "--formulas") opts.formulas = val;
+            if (arg == "-o" || arg == "--output") opts.output = val;
+            if (arg == "-t" || arg == "--trace") opts.trace = val;
+            if (arg == "-s" || arg == "--serve") opts.serve = val;
+        } else if (!arg.empty() && arg[0] == '-') {
+            std::cerr << "canno: unknown option " << arg << "\n";
+            return std::nullopt;
+        } else {
+            opts.ranges.push_back(arg);
+        }
+    }
+
+    if (opts.input.empty() && opts.formulas.empty() && opts.serve.empty()) {
+        std::cerr << "canno: nothing to do, pass --input, --formulas or --serve\n";
+        return std::nullopt;
+    }
+
+    return opts;
+}
+
+static std::optional<Range> parse_range(const std::string& text) {
+    auto delim_pos = text.find(':');
+    auto first = cell_ref_to_indices(text.substr(0, delim_pos));
+    auto last = delim_pos == std::string::npos ? first : cell_ref_to_indices(text.substr(delim_pos + 1));
+    if (!first.has_value() || !last.has_value()) return std::nullopt;
+
+    return Range{first->first, first->second, last->first, last->second};
+}
+
+static bool load_csv(const std::string& path, std::vector<Assignment>& out) {
+    std::ifstream in(path);
+    if (!in) {
+        std::cerr << "canno: cannot open " << path << "\n";
+        return false;
+    }
+
+    auto rows = read_csv(in);
+    for (size_t row = 0; row < rows.size(); ++row) {
+        for (size_t col = 0; col < rows[row].size(); ++col) {
+            if (rows[row][col].empty()) continue;
+            out.push_back({static_cast<int>(col), static_cast<int>(row), std::move(rows[row][col])});
+        }
+    }
+    return true;
+}
+
+static bool load_overlay(const std::string& path, std::vector<Assignment>& out) {
+    std::ifstream in(path);
+    if (!in) {
+        std::cerr << "canno: cannot open " << path << "\n";
+        return false;
+    }
+
+    std::string line;
+    for (int line_no = 1; std::getline(in, line); ++line_no) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+
+        auto ref_start = line.find_first_not_of(" \t");
+        if (ref_start == std::string::npos || line[ref_start] == '#') continue;
+
+        auto ref_end = line.find_first_of(" \t", ref_start);
+        auto val_start = ref_end == std::string::npos ? std::string::npos : line.find_first_not_of(" \t", ref_end);
+        std::string ref = line.substr(ref_start, ref_end - ref_start);
+        std::string value = val_start == std::string::npos ? "" : line.substr(val_start);
+
+        auto indices = cell_ref_to_indices(ref);
+        if (!indices.has_value()) {
+            std::cerr << "canno: " << path << ":" << line_no << ": invalid cell reference '" << ref << "'\n";
+            return false;
+        }
+        out.push_back({indices->first, indices->second, value});
+    }
+    return true;
+}
+
+static void report(bool quiet, const char* phase, Clock::time_point start) {
+    if (trace_enabled()) {
+        // Clock is the steady clock the trace uses too
+        auto start_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(start.time_since_epoch()).count();
+        trace_record(phase, "phase", start_ns, trace_now_ns(), "");
+    }
+    if (quiet) return;
+    std::chrono::duration<double, std::milli> elapsed = Clock::now() - start;
+    std::cerr << std::left << std::setw(8) << phase << std::right << std::fixed << std::setprecision(3)
+              << std::setw(12) << elapsed.count() << " ms\n";
+}
+
+static bool finish_trace(const std::string& path) {
+    if (path.empty()) return true;
+
+    trace_stop();
+    if (!trace_write(path)) {
+        std::cerr << "canno: cannot write " << path << "\n";
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    auto opts_opt = parse_args(argc, argv);
+    if (!opts_opt.has_value()) {
+        usage(std::cerr);
+        return 1;
+    }
+    const auto& opts = opts_opt.value();
+
+    std::vector<Range> ranges;
+    for (auto& text : opts.ranges) {
+        auto range = parse_range(text);
+        if (!range.has_value()) {
+            std::cerr << "canno: invalid range '" << text << "'\n";
+            return 1;
+        }
+        ranges.push_back(*range);
+    }
+
+    if (!opts.trace.empty()) trace_start();
+
+    // Load: read and parse the input files, nothing touches the sheet yet
+    auto start = Clock::now();
+    std::vector<Assignment> assignments;
+    if (!opts.input.empty() && !load_csv(opts.input, assignments)) return 1;
+    if (!opts.formulas.empty() && !load_overlay(opts.formulas, assignments)) return 1;
+    report(opts.quiet, "load", start);
+
+    // Graph build: setting the cells parses formulas and wires their dependencies
+    start = Clock::now();
+    auto sheet = std::make_shared<Sheet>();
+    sheet->init_cells();
+
+    int last_col = -1;
+    int last_row = -1;
+    size_t skipped = 0;
+    for (auto& a : assignments) {
+        if (!sheet->set_cell(a.col, a.row, a.value)) {
+            ++skipped;
+            continue;
+        }
+        last_col = std::max(last_col, a.col);
+        last_row = std::max(last_row, a.row);
+    }
+    report(opts.quiet, "graph", start);
+
+    if (skipped > 0) {
+        std::cerr << "canno: " << skipped << " cells outside the " << Sheet::SHEET_COLS << "x" << Sheet::SHEET_ROWS
+                  << " sheet were ignored\n";
+    }
+
+    if (!opts.serve.empty()) {
+        Server server(sheet, opts.serve);
+        if (!server.start()) return 1;
+
+        active_server = &server;
+        std::signal(SIGINT, stop_server);
+        std::signal(SIGTERM, stop_server);
+        if (!opts.quiet) std::cerr << "serving on " << opts.serve << "\n";
+
+        server.run();
+        active_server = nullptr;
+        // Everything the clients did while being served ends up in the trace
+        return finish_trace(opts.trace) ? 0 : 1;
+    }
+
+    // Default export starts at A1 so the output lines up with the input CSV
+    if (ranges.empty() && last_col >= 0) {
+        ranges.push_back({0, 0, last_col, last_row});
+    }
+
+    // Recalc: evaluation is lazy, so force every cell that is going to be exported. Array
+    // formulas spill first, once for the whole load
+    start = Clock::now();
+    sheet->flush_spills();
+    for (auto& range : ranges) {
+        for (int col = range.first_col; col <= range.last_col; ++col) {
+            for (int row = range.first_row; row <= range.last_row; ++row) {
+                sheet->get_cell_val(col, row);
+            }
+        }
+    }
+    report(opts.quiet, "recalc", start);
+
+    // Export: one CSV block per range, separated by an empty line
+    start = Clock::now();
+    std::ofstream file;
+    if (!opts.output.empty()) {
+        file.open(opts.output);
+        if (!file) {
+            std::cerr << "canno: cannot write " << opts.output << "\n";
+            return 1;
+        }
+    }
+    std::ostream& out = opts.output.empty() ? std::cout : file;
+
+    for (size_t i = 0; i < ranges.size(); ++i) {
+        if (i > 0) out << '\n';
+
+        const auto& range = ranges[i];
+        std::vector<std::string> fields;
+        for (int row = range.first_row; row <= range.last_row; ++row) {
+            fields.clear();
+            for (int col = range.first_col; col <= range.last_col; ++col) {
+                fields.push_back(sheet->get_cell_val(col, row).value_or(""));
+            }
+            write_csv_row(out, fields);
+        }
+    }
+    out.flush();
+    report(opts.quiet, "export", start);
+
+    if (!finish_trace(opts.trace)) return 1;
+
+    return out ? 0 : 1;
+}
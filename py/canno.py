@@ -18,6 +18,21 @@ class CannoFFI:
         self.lib.sheet_get_cell_formula.argtypes = [ctypes.c_void_p, ctypes.c_int, ctypes.c_int]
         self.lib.sheet_get_cell_formula.restype = ctypes.c_char_p
 
+        self.lib.sheet_set_cell_format.argtypes = [ctypes.c_void_p, ctypes.c_int, ctypes.c_int, ctypes.c_char_p]
+        self.lib.sheet_set_cell_format.restype = ctypes.c_int
+
+        self.lib.sheet_get_range_vals.argtypes = [ctypes.c_void_p, ctypes.c_int, ctypes.c_int, ctypes.c_int, ctypes.c_int]
+        self.lib.sheet_get_range_vals.restype = ctypes.c_char_p
+
+        self.lib.sheet_memory_report.argtypes = [ctypes.c_void_p]
+        self.lib.sheet_memory_report.restype = ctypes.c_char_p
+
+        self.lib.sheet_set_memory_budget.argtypes = [ctypes.c_void_p, ctypes.c_ulonglong]
+        self.lib.sheet_set_memory_budget.restype = None
+
+        self.lib.sheet_trace_write.argtypes = [ctypes.c_char_p]
+        self.lib.sheet_trace_write.restype = ctypes.c_int
+
         self.lib.sheet_cols.argtypes = [ctypes.c_void_p]
         self.lib.sheet_cols.restype = ctypes.c_int
 
@@ -27,6 +42,9 @@ class CannoFFI:
     def set_cell(self, col, row, value):
         return self.lib.sheet_set_cell(self.sheet, col, row, value.encode())
 
+    def set_cell_format(self, col, row, fmt):
+        return self.lib.sheet_set_cell_format(self.sheet, col, row, fmt.encode())
+
     def get_cell_val(self, col, row):
         val = self.lib.sheet_get_cell_val(self.sheet, col, row)
         return val.decode() if val else ""
@@ -35,6 +53,30 @@ class CannoFFI:
         form = self.lib.sheet_get_cell_formula(self.sheet, col, row)
         return form.decode() if form else ""
 
+    def get_range_vals(self, col, row, cols, rows):
+        """Values of a rectangle in one call, as a list of rows"""
+        if cols <= 0 or rows <= 0:
+            return []
+        vals = self.lib.sheet_get_range_vals(self.sheet, col, row, cols, rows)
+        flat = vals.decode().split("\x1f") if vals is not None else []
+        return [flat[r * cols:(r + 1) * cols] for r in range(rows)]
+
+    def memory_report(self):
+        report = self.lib.sheet_memory_report(self.sheet).decode()
+        return {key: int(val) for key, val in (line.split("=") for line in report.splitlines())}
+
+    def set_memory_budget(self, nbytes):
+        self.lib.sheet_set_memory_budget(self.sheet, nbytes)
+
+    def trace_start(self):
+        self.lib.sheet_trace_start()
+
+    def trace_stop(self):
+        self.lib.sheet_trace_stop()
+
+    def trace_write(self, path):
+        return self.lib.sheet_trace_write(path.encode())
+
     def cols(self):
         return self.lib.sheet_cols(self.sheet)
 
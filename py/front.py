@@ -7,27 +7,22 @@ canno = CannoFFI()
 cols = canno.cols()
 rows = canno.rows()
 
+CELL_W = 100
+CELL_H = 22
+HEADER_W = 40
+
 root = tk.Tk()
 root.title("Canno Spreadsheet")
-root.geometry("800x600") 
+root.geometry("800x600")
 
 frame = tk.Frame(root)
 frame.pack(expand=True, fill="both")
 
-canvas = tk.Canvas(frame)
-scrollbar_y = tk.Scrollbar(frame, orient="vertical", command=canvas.yview)
-scrollbar_x = tk.Scrollbar(frame, orient="horizontal", command=canvas.xview)
-scrollable_frame = tk.Frame(canvas)
-
-scrollable_frame.bind(
-    "<Configure>",
-    lambda e: canvas.configure(
-        scrollregion=canvas.bbox("all")
-    )
-)
-
-canvas.create_window((0, 0), window=scrollable_frame, anchor="nw")
-canvas.configure(yscrollcommand=scrollbar_y.set, xscrollcommand=scrollbar_x.set)
+# Only the visible part of the sheet exists as widgets, scrolling moves the
+# viewport and reuses the same widgets for other cells
+canvas = tk.Canvas(frame, highlightthickness=0)
+scrollbar_y = tk.Scrollbar(frame, orient="vertical")
+scrollbar_x = tk.Scrollbar(frame, orient="horizontal")
 
 canvas.grid(row=0, column=0, sticky="nsew")
 scrollbar_y.grid(row=0, column=1, sticky="ns")
@@ -36,7 +31,16 @@ scrollbar_x.grid(row=1, column=0, sticky="ew")
 frame.grid_rowconfigure(0, weight=1)
 frame.grid_columnconfigure(0, weight=1)
 
-entries = {}
+top_row = 0
+left_col = 0
+visible_rows = 0
+visible_cols = 0
+
+col_labels = []
+row_labels = []
+entries = []   # pool of Entry widgets, entries[r][c] shows cell (top_row + r, left_col + c)
+shown = {}     # entry -> text it currently displays
+editing = None # (row, col) of the cell being edited
 
 def col_label(index):
     label = ""
@@ -45,42 +49,135 @@ def col_label(index):
         index = index // 26 - 1
     return label
 
-for c in range(cols):
-    label = tk.Label(scrollable_frame, text=col_label(c), borderwidth=1, relief="raised", width=10)
-    label.grid(row=0, column=c+1, sticky="nsew")
+def make_entry(r, c):
+    e = tk.Entry(canvas, relief="solid", borderwidth=1)
+    e.bind("<FocusIn>", lambda event, r=r, c=c: enter_cell(r, c))
+    e.bind("<FocusOut>", lambda event, r=r, c=c: save_cell(r, c))
+    e.bind("<Return>", lambda event: root.focus_set())
+    shown[e] = ""
+    return e
+
+def layout():
+    """Grow the widget pool to fit the window, hide what falls outside it"""
+    global visible_rows, visible_cols
+
+    width = max(canvas.winfo_width() - HEADER_W, 0)
+    height = max(canvas.winfo_height() - CELL_H, 0)
+    visible_cols = min(cols, width // CELL_W + 1)
+    visible_rows = min(rows, height // CELL_H + 1)
+
+    while len(col_labels) < visible_cols:
+        col_labels.append(tk.Label(canvas, borderwidth=1, relief="raised"))
+    while len(row_labels) < visible_rows:
+        row_labels.append(tk.Label(canvas, borderwidth=1, relief="raised"))
+    while len(entries) < visible_rows:
+        entries.append([])
+    for r in range(visible_rows):
+        while len(entries[r]) < visible_cols:
+            entries[r].append(make_entry(r, len(entries[r])))
+
+    for c, label in enumerate(col_labels):
+        if c < visible_cols:
+            label.place(x=HEADER_W + c * CELL_W, y=0, width=CELL_W, height=CELL_H)
+        else:
+            label.place_forget()
+    for r, label in enumerate(row_labels):
+        if r < visible_rows:
+            label.place(x=0, y=CELL_H + r * CELL_H, width=HEADER_W, height=CELL_H)
+        else:
+            label.place_forget()
+    for r, row_entries in enumerate(entries):
+        for c, e in enumerate(row_entries):
+            if r < visible_rows and c < visible_cols:
+                e.place(x=HEADER_W + c * CELL_W, y=CELL_H + r * CELL_H, width=CELL_W, height=CELL_H)
+            else:
+                e.place_forget()
+
+    scroll_to(top_row, left_col)
 
-for r in range(rows):
-    label = tk.Label(scrollable_frame, text=str(r+1), borderwidth=1, relief="raised", width=4)
-    label.grid(row=r+1, column=0, sticky="nsew")
-
-def draw_sheet():
-    for r in range(rows):
-        for c in range(cols):
-            val = canno.get_cell_val(c, r)
-            e = tk.Entry(scrollable_frame, width=15)
-            e.grid(row=r + 1, column=c + 1)
+def update_sheet():
+    """Fetch the visible rectangle in one call and touch only changed widgets"""
+    vals = canno.get_range_vals(left_col, top_row, visible_cols, visible_rows)
+    for r, row_vals in enumerate(vals):
+        for c, val in enumerate(row_vals):
+            e = entries[r][c]
+            if editing == (top_row + r, left_col + c) or shown[e] == val:
+                continue
+            e.delete(0, tk.END)
             e.insert(0, val)
-            entries[(r, c)] = e
-            e.bind("<FocusOut>", lambda event, row=r, col=c: save_cell(event, row, col))
-            e.bind("<FocusIn>", lambda event, row=r, col=c: enter_cell(event, row, col))
+            shown[e] = val
 
-def update_sheet():
-    for r in range(rows):
-        for c in range(cols):
-            val = canno.get_cell_val(c, r)
-            entries[(r, c)].delete(0, tk.END)
-            entries[(r, c)].insert(0, val)
-
-def enter_cell(event, row, col):
-    formula = canno.get_cell_formula( col, row)
-    if formula:
-        entries[(row, col)].delete(0, tk.END)
-        entries[(row, col)].insert(0, formula)
+def scroll_to(row, col):
+    global top_row, left_col
 
-def save_cell(event, row, col):
-    value = entries[(row, col)].get()
-    canno.set_cell(col, row, value)
+    row = max(0, min(row, rows - visible_rows))
+    col = max(0, min(col, cols - visible_cols))
+
+    if (row, col) != (top_row, left_col) and editing is not None:
+        # Commit the edit before its widget starts showing another cell
+        root.focus_set()
+        save_cell(editing[0] - top_row, editing[1] - left_col)
+
+    top_row, left_col = row, col
+
+    for c in range(visible_cols):
+        col_labels[c].config(text=col_label(left_col + c))
+    for r in range(visible_rows):
+        row_labels[r].config(text=str(top_row + r + 1))
+
+    scrollbar_y.set(top_row / rows, (top_row + visible_rows) / rows)
+    scrollbar_x.set(left_col / cols, (left_col + visible_cols) / cols)
+
+    update_sheet()
+
+def scroll_command(total, visible, position, current):
+    def command(action, amount, unit=None):
+        if action == "moveto":
+            return scroll_to(*position(int(float(amount) * total)))
+        step = visible() if unit == "pages" else 1
+        return scroll_to(*position(current() + int(amount) * step))
+    return command
+
+scrollbar_y.config(command=scroll_command(
+    rows, lambda: visible_rows, lambda r: (r, left_col), lambda: top_row))
+scrollbar_x.config(command=scroll_command(
+    cols, lambda: visible_cols, lambda c: (top_row, c), lambda: left_col))
+
+def on_wheel(event):
+    if event.num == 4 or event.delta > 0:
+        scroll_to(top_row - 3, left_col)
+    else:
+        scroll_to(top_row + 3, left_col)
+
+canvas.bind("<Configure>", lambda event: layout())
+root.bind_all("<MouseWheel>", on_wheel)
+root.bind_all("<Button-4>", on_wheel)
+root.bind_all("<Button-5>", on_wheel)
+
+def enter_cell(r, c):
+    global editing
+    row, col = top_row + r, left_col + c
+    editing = (row, col)
+    formula = canno.get_cell_formula(col, row)
+    if formula:
+        e = entries[r][c]
+        e.delete(0, tk.END)
+        e.insert(0, formula)
+        shown[e] = formula
+
+def save_cell(r, c):
+    global editing
+    if editing != (top_row + r, left_col + c):
+        return
+    row, col = editing
+    editing = None
+    e = entries[r][c]
+    value = e.get()
+    unchanged = value == shown[e]
+    # Force the next refresh to rewrite this widget, it may show a formula
+    shown[e] = None
+    if not unchanged:
+        canno.set_cell(col, row, value)
     update_sheet()
 
-draw_sheet()
-root.mainloop()
\ No newline at end of file
+root.mainloop()
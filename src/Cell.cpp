@@ -6,15 +6,107 @@
 
 #include "Formula.hpp"
 #include "Sheet.hpp"
+#include "StringPool.hpp"
+#include "Trace.hpp"
+#include "Utils.hpp"
 
-Cell::Cell(std::shared_ptr<Sheet> sheet) : sheet(sheet) {}
+Cell::Cell(std::shared_ptr<Sheet> sheet, int col, int row) : sheet(sheet), col(col), row(row) {}
 
-std::string Cell::get_value() {
+Cell::~Cell() { sheet->strings().release(text); }
+
+std::string Cell::name() const {
+    if (col < 0) return formula.has_value() ? formula->get_text() : "";
+    return indices_to_cell_ref(col, row);
+}
+
+void Cell::refresh() {
     if (dirty && formula.has_value()) {
-        value = compute_value();
+        TraceSpan span("evaluate", "cell");
+        if (span.active()) span.set_arg(name());
+
+        store(compute_value());
         dirty = false;
+    } else if (dirty && spill_source != nullptr) {
+        // The anchor writes every spilled value, this one included
+        dirty = false;
+        spill_source->refresh();
+    }
+}
+
+const std::string& Cell::get_value() {
+    static const std::string empty;
+
+    refresh();
+
+    if (kind == Kind::EMPTY) return empty;
+    // Numbers keep the spelling they were typed with until a number format is set
+    if (text != nullptr && (kind == Kind::TEXT || format.kind == NumberFormat::Kind::GENERAL)) return *text;
+
+    if (!display_valid) {
+        display = format_number(number, format);
+        display_valid = true;
     }
-    return value;
+    return display;
+}
+
+std::string Cell::get_raw_value() {
+    refresh();
+
+    if (kind == Kind::EMPTY) return "";
+    if (text != nullptr) return *text;
+    // The display cache holds the same string as long as no number format is set
+    return format.kind == NumberFormat::Kind::GENERAL ? get_value() : pretty_print_double(number);
+}
+
+bool Cell::get_number(double& out) {
+    refresh();
+    if (kind != Kind::NUMBER) return false;
+    out = number;
+    return true;
+}
+
+void Cell::set_format(const NumberFormat& fmt) {
+    format = fmt;
+    display_valid = false;
+}
+
+void Cell::store(const std::string& val) {
+    if (val.empty()) {
+        clear_value();
+        return;
+    }
+
+    double d;
+    bool is_number = parse_number(val, d);
+
+    // Only numbers that do not print back the same way, e.g. 007 or 1e3, need their text
+    if (is_number && pretty_print_double(d) == val) {
+        store_number(d);
+        return;
+    }
+
+    auto& pool = sheet->strings();
+    const std::string* interned = pool.intern(val);
+    pool.release(text);
+    text = interned;
+    number = is_number ? d : 0.0;
+    kind = is_number ? Kind::NUMBER : Kind::TEXT;
+    display_valid = false;
+}
+
+void Cell::store_number(double d) {
+    sheet->strings().release(text);
+    text = nullptr;
+    number = d;
+    kind = Kind::NUMBER;
+    display_valid = false;
+}
+
+void Cell::clear_value() {
+    sheet->strings().release(text);
+    text = nullptr;
+    kind = Kind::EMPTY;
+    display_valid = false;
 }
 
 std::optional<std::string> Cell::get_formula() {
@@ -25,39 +117,94 @@ std::optional<std::string> Cell::get_formula() {
 }
 
 void Cell::set_value(const std::string& val) {
+    auto anchor = spill_source;
+    detach_from_spill();
+    release_spill();
+    clear_spill_blockers();
+    release_subexpressions();
+
     if (!val.empty() && val[0] == '=') {
         formula = Formula(shared_from_this(), val);
-
-        for (auto& parent : parents) {
-            auto& siblings = parent->children;
-            siblings.erase(std::remove(siblings.begin(), siblings.end(), shared_from_this()), siblings.end());
-        }
-        parents.clear();
-        auto deps = formula->calc_deps(sheet);
-
-        for (auto& dep : deps) {
-            parents.push_back(dep);
-        }
-
-        for (auto& parent : parents) {
-            parent->children.emplace_back(shared_from_this());
-        }
-
-        dirty = true;
+        attach_formula();
     } else {
+        detach_parents();
         formula.reset();
-        value = val;
+        store(val);
         dirty = false;
     }
 
+    TraceSpan span("mark_dirty", "graph");
+    if (span.active()) span.set_arg(name());
     for (auto& child : children) {
         child->mark_dirty();
     }
+
+    // Writing into a spill range blocks (or unblocks) the array formula it came from
+    if (anchor != nullptr) {
+        anchor->mark_dirty();
+    }
+}
+
+void Cell::set_shared_formula(const std::string& key, const std::shared_ptr<Node>& node) {
+    formula = Formula(shared_from_this(), key, node);
+    attach_formula();
+}
+
+void Cell::reattach_formula() {
+    if (formula.has_value()) attach_formula();
+}
+
+void Cell::release_subexpressions() {
+    if (formula.has_value()) formula->release_subexpressions(sheet);
+}
+
+void Cell::attach_formula() {
+    TraceSpan span("rewire", "graph");
+    if (span.active()) span.set_arg(name());
+
+    formula->share_subexpressions(sheet);
+
+    auto self = shared_from_this();
+    auto old_parents = std::move(parents);
+    parents = formula->calc_deps(sheet);
+    for (auto& parent : parents) {
+        parent->children.emplace_back(self);
+    }
+
+    // The old edges go only after the new ones exist, so a shared subexpression the new formula
+    // reuses still has a child and is not released
+    unlink_parents(old_parents);
+
+    dirty = true;
+    if (formula->is_array()) sheet->queue_spill(self);
+}
+
+void Cell::detach_parents() {
+    auto old_parents = std::move(parents);
+    parents.clear();
+    unlink_parents(old_parents);
+}
+
+void Cell::unlink_parents(const std::vector<std::shared_ptr<Cell>>& old_parents) {
+    auto self = shared_from_this();
+
+    for (auto& parent : old_parents) {
+        // One edge at a time, a parent referenced twice also has this cell twice as a child
+        auto& siblings = parent->children;
+        auto it = std::find(siblings.begin(), siblings.end(), self);
+        if (it != siblings.end()) siblings.erase(it);
+
+        // Shared subexpressions live only as long as some formula uses them
+        if (siblings.empty() && parent->col < 0) {
+            sheet->release_shared_expr(parent);
+        }
+    }
 }
 
 void Cell::mark_dirty() {
     if (!dirty) {
         dirty = true;
+        if (formula.has_value() && formula->is_array()) sheet->queue_spill(shared_from_this());
         for (auto& child : children) {
             child->mark_dirty();
         }
@@ -69,10 +216,143 @@ void Cell::add_parent(const std::shared_ptr<Cell>& parent) {
     parent->children.push_back(shared_from_this());
 }
 
+void Cell::remove_edge(const std::shared_ptr<Cell>& parent) {
+    parents.erase(std::remove(parents.begin(), parents.end(), parent), parents.end());
+    auto& siblings = parent->children;
+    siblings.erase(std::remove(siblings.begin(), siblings.end(), shared_from_this()), siblings.end());
+}
+
 std::string Cell::compute_value() {
     if (!formula.has_value()) {
-        return value;
+        return get_raw_value();
+    }
+
+    auto result = formula->evaluate(sheet);
+
+    if (formula->is_array()) {
+        if (formula->has_failed()) {
+            release_spill();
+            return result;
+        }
+        if (auto err = spill(formula->get_spill())) {
+            return *err;
+        }
+    }
+
+    return result;
+}
+
+std::optional<std::string> Cell::spill(const ArrayValue& result) {
+    auto self = shared_from_this();
+    clear_spill_blockers();
+
+    std::vector<std::shared_ptr<Cell>> targets;
+    std::vector<std::shared_ptr<Cell>> blockers;
+    for (int x = 0; x < result.cols; ++x) {
+        for (int y = 0; y < result.rows; ++y) {
+            if (x == 0 && y == 0) continue;
+
+            auto target = sheet->get_cell(col + x, row + y);
+            if (target == nullptr) {
+                release_spill();
+                return "#ERR: Spill range off sheet";
+            }
+
+            bool occupied = target->formula.has_value() || target->kind != Kind::EMPTY || target->spill_source != nullptr;
+            if (target->spill_source != self && occupied) {
+                blockers.push_back(target);
+            }
+            targets.push_back(target);
+        }
+    }
+
+    if (!blockers.empty()) {
+        release_spill();
+        // Recalculate once a blocking cell is cleared
+        for (auto& blocker : blockers) {
+            if (std::find(parents.begin(), parents.end(), blocker) != parents.end()) continue;
+            add_parent(blocker);
+            spill_blockers.push_back(blocker);
+        }
+        return "#ERR: Spill range blocked";
+    }
+
+    for (auto& old : spill_targets) {
+        if (std::find(targets.begin(), targets.end(), old) == targets.end()) {
+            release_spill_target(old);
+        }
+    }
+
+    size_t i = 0;
+    for (int x = 0; x < result.cols; ++x) {
+        for (int y = 0; y < result.rows; ++y) {
+            if (x == 0 && y == 0) continue;
+
+            auto& target = targets[i++];
+            target->store_number(result.data[x * result.rows + y]);
+            target->dirty = false;
+
+            if (target->spill_source != self) {
+                target->spill_source = self;
+                target->add_parent(self);
+                for (auto& child : target->children) {
+                    child->mark_dirty();
+                }
+            }
+        }
+    }
+
+    spill_targets = std::move(targets);
+    return std::nullopt;
+}
+
+void Cell::release_spill_target(const std::shared_ptr<Cell>& target) {
+    target->spill_source = nullptr;
+    target->clear_value();
+    target->dirty = false;
+    target->remove_edge(shared_from_this());
+
+    for (auto& child : target->children) {
+        child->mark_dirty();
+    }
+}
+
+void Cell::release_spill() {
+    for (auto& target : spill_targets) {
+        release_spill_target(target);
+    }
+    spill_targets.clear();
+}
+
+void Cell::clear_spill_blockers() {
+    for (auto& blocker : spill_blockers) {
+        remove_edge(blocker);
+    }
+    spill_blockers.clear();
+}
+
+void Cell::detach_from_spill() {
+    if (spill_source == nullptr) return;
+
+    auto& siblings = spill_source->spill_targets;
+    siblings.erase(std::remove(siblings.begin(), siblings.end(), shared_from_this()), siblings.end());
+    remove_edge(spill_source);
+    spill_source = nullptr;
+}
+
+void Cell::add_memory(MemoryReport& report) const {
+    report.cells += sizeof(Cell) + SHARED_PTR_OVERHEAD;
+    report.values += heap_bytes(display);
+
+    // Hidden shared subexpression cells are not part of the grid
+    if (col >= 0 && (kind != Kind::EMPTY || formula.has_value())) report.populated_cells++;
+
+    if (formula.has_value()) {
+        report.formula_count++;
+        report.formulas += formula->memory_usage();
     }
 
-    return formula->evaluate(sheet);
+    report.edge_count += parents.size();
+    report.edges += heap_bytes(parents) + heap_bytes(children);
+    report.spills += heap_bytes(spill_targets) + heap_bytes(spill_blockers);
 }
@@ -6,24 +6,70 @@
 #include <vector>
 
 #include "Formula.hpp"
+#include "Memory.hpp"
+#include "Utils.hpp"
 
 class Cell : public std::enable_shared_from_this<Cell> {
 public:
-    explicit Cell(std::shared_ptr<Sheet> parent_sheet);
+    Cell(std::shared_ptr<Sheet> parent_sheet, int col, int row);
+    ~Cell();
 
-    std::string get_value();
+    // Display string, formatted with the cell's number format
+    const std::string& get_value();
+    // Unformatted value as formulas see it
+    std::string get_raw_value();
+    bool get_number(double& out);
     void set_value(const std::string& val);
+    void set_shared_formula(const std::string& key, const std::shared_ptr<Node>& node);
+    // Looks up shared subexpressions and dependencies of the current formula again
+    void reattach_formula();
+    void release_subexpressions();
     std::optional<std::string> get_formula();
+    void set_format(const NumberFormat& fmt);
 
     void mark_dirty();
     void add_parent(const std::shared_ptr<Cell>& parent);
+    void detach_parents();
+
+    // A1 style reference, or the subexpression for hidden shared cells
+    std::string name() const;
+    bool is_spilled() const { return spill_source != nullptr; }
+    void add_memory(MemoryReport& report) const;
 
 private:
     std::shared_ptr<Sheet> sheet;
+    int col;
+    int row;
     std::string compute_value();
-    std::string value;
+    void refresh();
+    void store(const std::string& val);
+    void store_number(double d);
+    void clear_value();
+    void attach_formula();
+    void unlink_parents(const std::vector<std::shared_ptr<Cell>>& old_parents);
+    std::optional<std::string> spill(const ArrayValue& result);
+    void release_spill();
+    void release_spill_target(const std::shared_ptr<Cell>& target);
+    void clear_spill_blockers();
+    void detach_from_spill();
+    void remove_edge(const std::shared_ptr<Cell>& parent);
+
+    // Text lives in the sheet's string pool, the display of numbers is built on first read.
+    // A number keeps its text too when it was typed in a form the general format would not print
+    enum class Kind { EMPTY, NUMBER, TEXT } kind = Kind::EMPTY;
+    double number = 0.0;
+    const std::string* text = nullptr;
+    std::string display;
+    bool display_valid = false;
+    NumberFormat format;
+
     std::optional<Formula> formula = std::nullopt;
     std::vector<std::shared_ptr<Cell>> parents;
     std::vector<std::shared_ptr<Cell>> children;
     bool dirty = false;
+
+    // Array formula this cell shows a value of, and the cells an array formula here spilled into
+    std::shared_ptr<Cell> spill_source = nullptr;
+    std::vector<std::shared_ptr<Cell>> spill_targets;
+    std::vector<std::shared_ptr<Cell>> spill_blockers;
 };
@@ -0,0 +1,81 @@
+#include "Csv.hpp"
+
+#include <istream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+std::vector<std::vector<std::string>> read_csv(std::istream& in) {
+    std::vector<std::vector<std::string>> rows;
+    std::vector<std::string> row;
+    std::string field;
+    bool quoted = false;
+    bool row_started = false;
+
+    char c;
+    while (in.get(c)) {
+        row_started = true;
+
+        if (quoted) {
+            if (c == '"') {
+                if (in.peek() == '"') {
+                    in.get(c);
+                    field += '"';
+                } else {
+                    quoted = false;
+                }
+            } else {
+                field += c;
+            }
+            continue;
+        }
+
+        switch (c) {
+            case '"':
+                quoted = true;
+                break;
+            case ',':
+                row.push_back(std::move(field));
+                field.clear();
+                break;
+            case '\r':
+                break;
+            case '\n':
+                row.push_back(std::move(field));
+                field.clear();
+                rows.push_back(std::move(row));
+                row.clear();
+                row_started = false;
+                break;
+            default:
+                field += c;
+        }
+    }
+
+    if (row_started) {
+        row.push_back(std::move(field));
+        rows.push_back(std::move(row));
+    }
+
+    return rows;
+}
+
+void write_csv_row(std::ostream& out, const std::vector<std::string>& fields) {
+    for (size_t i = 0; i < fields.size(); ++i) {
+        if (i > 0) out << ',';
+
+        const auto& field = fields[i];
+        if (field.find_first_of(",\"\r\n") == std::string::npos) {
+            out << field;
+            continue;
+        }
+
+        out << '"';
+        for (char c : field) {
+            if (c == '"') out << '"';
+            out << c;
+        }
+        out << '"';
+    }
+    out << '\n';
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <istream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// RFC 4180 style: fields separated by ',', quoted with '"', quotes doubled inside
+std::vector<std::vector<std::string>> read_csv(std::istream& in);
+void write_csv_row(std::ostream& out, const std::vector<std::string>& fields);
@@ -1,6 +1,8 @@
 #include "Formula.hpp"
 
+#include <algorithm>
 #include <cctype>
+#include <charconv>
 #include <cstddef>
 #include <memory>
 #include <stdexcept>
@@ -8,7 +10,9 @@
 #include <vector>
 
 #include "Cell.hpp"
+#include "Memory.hpp"
 #include "Sheet.hpp"
+#include "Trace.hpp"
 #include "Utils.hpp"
 
 Formula::Formula(const std::shared_ptr<Cell>& cell, const std::string& expr) {
@@ -17,6 +21,13 @@ Formula::Formula(const std::shared_ptr<Cell>& cell, const std::string& expr) {
     parse(expr);
 }
 
+Formula::Formula(const std::shared_ptr<Cell>& cell, const std::string& key, const std::shared_ptr<Node>& node) {
+    text = key;
+    containing_cell = cell;
+    root = node;
+    shared_root = true;
+}
+
 std::string Formula::set_err(const std::string& err) {
     auto full_error = "#ERR: " + err;
     failed = true;
@@ -36,9 +47,126 @@ std::string Formula::evaluate(std::shared_ptr<Sheet> sheet) {
         return set_err("No root node");
     }
 
+    if (is_array()) {
+        if (!evaluate_array(sheet, root, spill)) return err_msg;
+        if (spill.data.empty()) return set_err("Empty array");
+        return pretty_print_double(spill.data[0]);
+    }
+
     return evaluate_node(sheet, root);
 }
 
+bool Formula::is_array() const { return is_array_node(root); }
+
+bool Formula::is_array_node(const std::shared_ptr<Node>& node) {
+    if (!node) return false;
+
+    switch (node->type) {
+        case Node::Type::CELL_RANGE:
+            return true;
+        case Node::Type::ADD:
+        case Node::Type::SUBTRACT:
+        case Node::Type::MULTIPLY:
+        case Node::Type::DIVIDE:
+            return is_array_node(node->left) || is_array_node(node->right);
+        default:
+            return false;
+    }
+}
+
+// A side with a single value is broadcast, the loops stay free of per element branches
+template <typename Op>
+static void elementwise(const ArrayValue& l, const ArrayValue& r, ArrayValue& out, Op op) {
+    const size_t n = out.data.size();
+    const double* a = l.data.data();
+    const double* b = r.data.data();
+    double* o = out.data.data();
+
+    if (l.data.size() == 1) {
+        const double s = a[0];
+        for (size_t i = 0; i < n; ++i) o[i] = op(s, b[i]);
+    } else if (r.data.size() == 1) {
+        const double s = b[0];
+        for (size_t i = 0; i < n; ++i) o[i] = op(a[i], s);
+    } else {
+        for (size_t i = 0; i < n; ++i) o[i] = op(a[i], b[i]);
+    }
+}
+
+bool Formula::evaluate_array(std::shared_ptr<Sheet> sheet, std::shared_ptr<Node> node, ArrayValue& out) {
+    if (!node) {
+        set_err("Missing operand");
+        return false;
+    }
+
+    if (node->type == Node::Type::CELL_RANGE) {
+        RangeValues values;
+        if (!fetch_range(sheet, node, values)) {
+            set_err("Invalid cell range " + node->value);
+            return false;
+        }
+        for (char is_num : values.is_number) {
+            if (!is_num) {
+                set_err("Expected number");
+                return false;
+            }
+        }
+        out.cols = values.cols;
+        out.rows = values.rows;
+        out.data = std::move(values.numbers);
+        return true;
+    }
+
+    if (!is_array_node(node)) {
+        auto val_str = evaluate_node(sheet, node);
+        double val;
+        if (failed) return false;
+        if (!parse_double(val_str, val)) {
+            set_err("Expected number");
+            return false;
+        }
+        out.cols = 1;
+        out.rows = 1;
+        out.data.assign(1, val);
+        return true;
+    }
+
+    ArrayValue l, r;
+    if (!evaluate_array(sheet, node->left, l) || !evaluate_array(sheet, node->right, r)) return false;
+
+    bool l_scalar = l.data.size() == 1;
+    bool r_scalar = r.data.size() == 1;
+    if (!l_scalar && !r_scalar && (l.cols != r.cols || l.rows != r.rows)) {
+        set_err("Array size mismatch");
+        return false;
+    }
+
+    const ArrayValue& shape = l_scalar ? r : l;
+    out.cols = shape.cols;
+    out.rows = shape.rows;
+    out.data.resize(shape.data.size());
+
+    switch (node->type) {
+        case Node::Type::ADD:
+            elementwise(l, r, out, [](double a, double b) { return a + b; });
+            break;
+        case Node::Type::SUBTRACT:
+            elementwise(l, r, out, [](double a, double b) { return a - b; });
+            break;
+        case Node::Type::MULTIPLY:
+            elementwise(l, r, out, [](double a, double b) { return a * b; });
+            break;
+        case Node::Type::DIVIDE:
+            elementwise(l, r, out, [](double a, double b) { return a / b; });
+            break;
+        default:
+            set_err("Unexpected array operation");
+            return false;
+    }
+
+    return true;
+}
+
 std::string Formula::evaluate_binary_op(std::shared_ptr<Sheet> sheet, std::shared_ptr<Node> left,
                                         std::shared_ptr<Node> right, const std::function<double(double, double)>& op) {
     auto left_val = evaluate_node(sheet, left);
@@ -54,11 +182,257 @@ std::string Formula::evaluate_binary_op(std::shared_ptr<Sheet> sheet, std::share
     }
 }
 
+// Argument layout of the conditional aggregates: where the (range, criteria)
+// pairs start and where the optional range to aggregate lives
+struct ConditionalLayout {
+    size_t first_pair;
+    int target;  // -1 = none, otherwise the argument index
+    bool single_pair;
+};
+
+static std::optional<ConditionalLayout> conditional_layout(const std::string& name) {
+    if (name == "COUNTIF") return ConditionalLayout{0, -1, true};
+    if (name == "SUMIF" || name == "AVERAGEIF") return ConditionalLayout{0, 2, true};
+    if (name == "COUNTIFS") return ConditionalLayout{0, -1, false};
+    if (name == "SUMIFS" || name == "AVERAGEIFS") return ConditionalLayout{1, 0, false};
+    return std::nullopt;
+}
+
+static bool iequals(const std::string& a, const std::string& b) {
+    return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [](char x, char y) {
+               return std::tolower(static_cast<unsigned char>(x)) == std::tolower(static_cast<unsigned char>(y));
+           });
+}
+
+static int icompare(const std::string& a, const std::string& b) {
+    size_t n = std::min(a.size(), b.size());
+    for (size_t i = 0; i < n; ++i) {
+        int x = std::tolower(static_cast<unsigned char>(a[i]));
+        int y = std::tolower(static_cast<unsigned char>(b[i]));
+        if (x != y) return x < y ? -1 : 1;
+    }
+    if (a.size() == b.size()) return 0;
+    return a.size() < b.size() ? -1 : 1;
+}
+
+Criterion Criterion::compile(const std::string& raw) {
+    Criterion crit;
+    size_t skip = 0;
+
+    if (raw.rfind(">=", 0) == 0) {
+        crit.op = Op::GE;
+        skip = 2;
+    } else if (raw.rfind("<=", 0) == 0) {
+        crit.op = Op::LE;
+        skip = 2;
+    } else if (raw.rfind("<>", 0) == 0) {
+        crit.op = Op::NE;
+        skip = 2;
+    } else if (raw.rfind(">", 0) == 0) {
+        crit.op = Op::GT;
+        skip = 1;
+    } else if (raw.rfind("<", 0) == 0) {
+        crit.op = Op::LT;
+        skip = 1;
+    } else if (raw.rfind("=", 0) == 0) {
+        crit.op = Op::EQ;
+        skip = 1;
+    }
+
+    crit.text = raw.substr(skip);
+
+    // Only the whole operand counts as a number, "1st" stays text
+    const char* begin = crit.text.data();
+    const char* end = begin + crit.text.size();
+    auto [ptr, ec] = std::from_chars(begin, end, crit.number);
+    crit.numeric = !crit.text.empty() && ec == std::errc() && ptr == end;
+
+    return crit;
+}
+
+void Formula::apply_criterion(const Criterion& crit, const RangeValues& values, std::vector<char>& mask) {
+    const size_t n = values.size();
+
+    if (crit.numeric) {
+        const double* nums = values.numbers.data();
+        const char* is_num = values.is_number.data();
+        char* m = mask.data();
+        const double c = crit.number;
+
+        // One tight loop per operator so the comparison is not branched on per cell
+        switch (crit.op) {
+            case Criterion::Op::EQ:
+                for (size_t i = 0; i < n; ++i) m[i] &= is_num[i] & (nums[i] == c);
+                break;
+            case Criterion::Op::NE:
+                for (size_t i = 0; i < n; ++i) m[i] &= !is_num[i] | (nums[i] != c);
+                break;
+            case Criterion::Op::LT:
+                for (size_t i = 0; i < n; ++i) m[i] &= is_num[i] & (nums[i] < c);
+                break;
+            case Criterion::Op::LE:
+                for (size_t i = 0; i < n; ++i) m[i] &= is_num[i] & (nums[i] <= c);
+                break;
+            case Criterion::Op::GT:
+                for (size_t i = 0; i < n; ++i) m[i] &= is_num[i] & (nums[i] > c);
+                break;
+            case Criterion::Op::GE:
+                for (size_t i = 0; i < n; ++i) m[i] &= is_num[i] & (nums[i] >= c);
+                break;
+        }
+        return;
+    }
+
+    for (size_t i = 0; i < n; ++i) {
+        if (!mask[i]) continue;
+
+        // Numbers carry no text, and a text criterion never matches one: "" is blank, "<>" is non-blank
+        const auto& val = values.text[i];
+        bool keep = false;
+        switch (crit.op) {
+            case Criterion::Op::EQ:
+                keep = !values.is_number[i] && iequals(val, crit.text);
+                break;
+            case Criterion::Op::NE:
+                keep = values.is_number[i] || !iequals(val, crit.text);
+                break;
+            case Criterion::Op::LT:
+                keep = !values.is_number[i] && icompare(val, crit.text) < 0;
+                break;
+            case Criterion::Op::LE:
+                keep = !values.is_number[i] && icompare(val, crit.text) <= 0;
+                break;
+            case Criterion::Op::GT:
+                keep = !values.is_number[i] && icompare(val, crit.text) > 0;
+                break;
+            case Criterion::Op::GE:
+                keep = !values.is_number[i] && icompare(val, crit.text) >= 0;
+                break;
+        }
+        mask[i] = keep;
+    }
+}
+
+bool Formula::fetch_range(std::shared_ptr<Sheet> sheet, std::shared_ptr<Node> node, RangeValues& out) {
+    std::string first = node->value;
+    std::string second = node->value;
+
+    if (node->type == Node::Type::CELL_RANGE) {
+        auto delim_pos = node->value.find(':');
+        if (delim_pos == std::string::npos) return false;
+        first = node->value.substr(0, delim_pos);
+        second = node->value.substr(delim_pos + 1);
+    } else if (node->type != Node::Type::CELL_REF) {
+        return false;
+    }
+
+    auto f_cell_i = cell_ref_to_indices(first);
+    auto s_cell_i = cell_ref_to_indices(second);
+    if (!f_cell_i.has_value() || !s_cell_i.has_value()) return false;
+
+    out.cols = std::max(0, s_cell_i->first - f_cell_i->first + 1);
+    out.rows = std::max(0, s_cell_i->second - f_cell_i->second + 1);
+
+    size_t count = static_cast<size_t>(out.cols) * static_cast<size_t>(out.rows);
+    out.text.clear();
+    out.text.reserve(count);
+    out.numbers.assign(count, 0.0);
+    out.is_number.assign(count, 0);
+
+    // Same column-major order as evaluate_range so ranges line up cell for cell
+    for (int x = f_cell_i->first; x <= s_cell_i->first; ++x) {
+        for (int y = f_cell_i->second; y <= s_cell_i->second; ++y) {
+            auto cell = sheet->get_cell(x, y);
+            if (cell == nullptr || cell == containing_cell) return false;
+
+            // Numbers come straight from the cell, only text is copied for the text predicates
+            size_t i = out.text.size();
+            out.is_number[i] = cell->get_number(out.numbers[i]);
+            out.text.push_back(out.is_number[i] ? std::string() : cell->get_raw_value());
+        }
+    }
+
+    return true;
+}
+
+std::string Formula::evaluate_conditional_func(std::shared_ptr<Sheet> sheet, std::shared_ptr<Node> node) {
+    auto layout = conditional_layout(node->value);
+    const auto& args = node->args;
+
+    size_t pairs_end = args.size();
+    if (layout->single_pair) {
+        size_t max_args = layout->target >= 0 ? 3 : 2;
+        if (args.size() < 2 || args.size() > max_args) return set_err("Wrong number of arguments for " + node->value);
+        pairs_end = 2;
+    } else if (args.size() < layout->first_pair + 2 || (args.size() - layout->first_pair) % 2 != 0) {
+        return set_err("Wrong number of arguments for " + node->value);
+    }
+
+    RangeValues values;
+    std::vector<char> mask;
+
+    for (size_t i = layout->first_pair; i < pairs_end; i += 2) {
+        if (!fetch_range(sheet, args[i], values)) return set_err("Invalid range for " + node->value);
+
+        if (i == layout->first_pair) {
+            mask.assign(values.size(), 1);
+        } else if (values.size() != mask.size()) {
+            return set_err("Range size mismatch");
+        }
+
+        const auto& crit_node = args[i + 1];
+        if (crit_node->criterion.has_value()) {
+            apply_criterion(*crit_node->criterion, values, mask);
+        } else {
+            // Criteria coming from a cell can only be compiled once the cell is known
+            auto raw = evaluate_node(sheet, crit_node);
+            if (failed) return raw;
+            apply_criterion(Criterion::compile(raw), values, mask);
+        }
+    }
+
+    if (node->value == "COUNTIF" || node->value == "COUNTIFS") {
+        size_t count = 0;
+        for (char m : mask) count += m;
+        return std::to_string(count);
+    }
+
+    // Without an explicit target SUMIF/AVERAGEIF aggregate the criteria range itself
+    if (layout->target >= 0 && static_cast<size_t>(layout->target) < args.size()) {
+        if (!fetch_range(sheet, args[layout->target], values)) return set_err("Invalid range for " + node->value);
+        if (values.size() != mask.size()) return set_err("Range size mismatch");
+    }
+
+    double total = 0.0;
+    size_t count = 0;
+    for (size_t i = 0; i < mask.size(); ++i) {
+        char take = mask[i] & values.is_number[i];
+        total += take ? values.numbers[i] : 0.0;
+        count += take;
+    }
+
+    if (node->value == "AVERAGEIF" || node->value == "AVERAGEIFS") {
+        if (count == 0) return set_err("No values to average");
+        return pretty_print_double(total / count);
+    }
+
+    return pretty_print_double(total);
+}
+
 std::string Formula::evaluate_func(std::shared_ptr<Sheet> sheet, std::shared_ptr<Node> node) {
-    // Flatten any ranges into individual CELL_REF nodes
+    if (conditional_layout(node->value).has_value()) {
+        return evaluate_conditional_func(sheet, node);
+    }
+
+    // Flatten any ranges into individual CELL_REF nodes, array expressions into their values
     std::vector<std::shared_ptr<Node>> args;
+    std::vector<double> array_vals;
     for (auto& arg : node->args) {
-        if (arg->type == Node::Type::CELL_RANGE) {
+        if (arg->type != Node::Type::CELL_RANGE && is_array_node(arg)) {
+            ArrayValue arr;
+            if (!evaluate_array(sheet, arg, arr)) return err_msg;
+            array_vals.insert(array_vals.end(), arr.data.begin(), arr.data.end());
+        } else if (arg->type == Node::Type::CELL_RANGE) {
             auto range_nodes = evaluate_range(arg);
             args.insert(args.end(), range_nodes.begin(), range_nodes.end());
         } else {
@@ -80,7 +454,8 @@ std::string Formula::evaluate_func(std::shared_ptr<Sheet> sheet, std::shared_ptr
 
     auto numeric_vals_opt = get_numeric_values(args);
     if (!numeric_vals_opt.has_value()) return set_err("Expected number");
-    const auto& numeric_vals = numeric_vals_opt.value();
+    auto& numeric_vals = numeric_vals_opt.value();
+    numeric_vals.insert(numeric_vals.end(), array_vals.begin(), array_vals.end());
 
     if (node->value == "SUM") {
         double total = 0.0;
@@ -132,6 +507,15 @@ std::vector<std::shared_ptr<Node>> Formula::evaluate_range(std::shared_ptr<Node>
 }
 
 std::string Formula::evaluate_node(std::shared_ptr<Sheet> sheet, std::shared_ptr<Node> node) {
+    if (node->shared) {
+        auto val = node->shared->get_raw_value();
+        if (val.rfind("#ERR: ", 0) == 0) {
+            failed = true;
+            err_msg = val;
+        }
+        return val;
+    }
+
     if (node->type == Node::Type::NUMBER) {
         return pretty_print_double(std::stod(node->value));
     } else if (node->type == Node::Type::STRING) {
@@ -144,7 +528,7 @@ std::string Formula::evaluate_node(std::shared_ptr<Sheet> sheet, std::shared_ptr
                 return set_err("Circular ref");
             }
 
-            return ref_cell->get_value();
+            return ref_cell->get_raw_value();
         } else {
             return set_err("unknown ref " + node->value);
         }
@@ -196,6 +580,18 @@ void Formula::tokenize(const std::string& expr) {
                 break;
         }
 
+        // "string"
+        if (c == '"') {
+            std::string str;
+            while (i + 1 < expr.size() && expr[i + 1] != '"') {
+                ++i;
+                str += expr[i];
+            }
+            ++i;  // closing quote
+            tokens.push_back({Token::STR_TOK, str});
+            continue;
+        }
+
         // Number
         if (isdigit(c) || c == '.') {
             std::string num;
@@ -251,6 +647,9 @@ void Formula::tokenize(const std::string& expr) {
 }
 
 void Formula::parse(const std::string& expr) {
+    TraceSpan span("parse", "formula");
+    if (span.active()) span.set_arg(expr);
+
     tokens.clear();
 
     tokenize(expr);
@@ -262,7 +661,12 @@ void Formula::parse(const std::string& expr) {
 
     current = 1;
 
-    root = parse_expression();
+    // A failed sub-parse leaves null operands and arguments behind, so nothing of a broken formula
+    // is kept and evaluation reports the parse error
+    auto node = parse_expression();
+    if (failed) return;
+
+    root = optimize(node);
 }
 
 // lowest precedence = + -
@@ -311,6 +715,10 @@ std::shared_ptr<Node> Formula::parse_factor() {
         advance();
         return std::make_shared<Node>(Node::Type::NUMBER, tok.value);
     }
+    if (tok.type == Token::STR_TOK) {
+        advance();
+        return std::make_shared<Node>(Node::Type::STRING, tok.value);
+    }
     if (tok.type == Token::CELL_REF_TOK) {
         advance();
         return std::make_shared<Node>(Node::Type::CELL_REF, tok.value);
@@ -348,6 +756,74 @@ std::shared_ptr<Node> Formula::parse_factor() {
     return nullptr;
 }
 
+// Folds constant subtrees into numbers and compiles literal criteria
+std::shared_ptr<Node> Formula::optimize(std::shared_ptr<Node> node) {
+    if (!node) return node;
+
+    node->left = optimize(node->left);
+    node->right = optimize(node->right);
+    for (auto& arg : node->args) {
+        arg = optimize(arg);
+    }
+
+    if (node->type != Node::Type::NUMBER && node->type != Node::Type::STRING && is_constant(node)) {
+        // Anything that fails is left for evaluation to report
+        auto saved_failed = failed;
+        auto saved_err = err_msg;
+        auto val = evaluate_node(nullptr, node);
+        bool ok = !failed;
+        failed = saved_failed;
+        err_msg = saved_err;
+
+        double num;
+        if (ok && parse_double(val, num)) {
+            return std::make_shared<Node>(Node::Type::NUMBER, val);
+        }
+    }
+
+    if (node->type == Node::Type::FUNCTION) {
+        compile_criteria(node);
+    }
+
+    return node;
+}
+
+bool Formula::is_constant(const std::shared_ptr<Node>& node) const {
+    if (!node) return false;
+
+    switch (node->type) {
+        case Node::Type::NUMBER:
+        case Node::Type::STRING:
+            return true;
+        case Node::Type::CELL_REF:
+        case Node::Type::CELL_RANGE:
+            return false;
+        case Node::Type::FUNCTION:
+            if (node->args.empty()) return false;
+            for (auto& arg : node->args) {
+                if (!is_constant(arg)) return false;
+            }
+            return true;
+        default:
+            return is_constant(node->left) && is_constant(node->right);
+    }
+}
+
+// Literal criteria of SUMIF and friends are compiled here so evaluation only runs the predicate
+void Formula::compile_criteria(std::shared_ptr<Node> func_node) {
+    auto layout = conditional_layout(func_node->value);
+    if (!layout.has_value()) return;
+
+    size_t end = layout->single_pair ? std::min<size_t>(2, func_node->args.size()) : func_node->args.size();
+    for (size_t i = layout->first_pair + 1; i < end; i += 2) {
+        auto& arg = func_node->args[i];
+        if (!arg) continue;
+        if (arg->type == Node::Type::STRING || arg->type == Node::Type::NUMBER) {
+            arg->criterion = Criterion::compile(arg->value);
+        }
+    }
+}
+
 bool Formula::match(std::initializer_list<Token> types) {
     if (at_end()) return false;
 
@@ -375,33 +851,150 @@ const TokenData& Formula::previous() const { return tokens[current - 1]; }
 
 bool Formula::at_end() const { return current >= tokens.size(); }
 
-void Formula::calc_node_deps(std::shared_ptr<Sheet> sheet, std::shared_ptr<Node> node) {
+void Formula::calc_node_deps(std::shared_ptr<Sheet> sheet, std::shared_ptr<Node> node,
+                             std::vector<std::shared_ptr<Cell>>& out) {
     if (!node) return;
 
+    // The shared cell stands in for everything below it
+    if (node->shared) {
+        out.push_back(node->shared);
+        return;
+    }
+
     if (node->type == Node::Type::CELL_REF) {
         if (auto cell = sheet->get_cell(node->value)) {
-            deps.push_back(cell);
+            out.push_back(cell);
         }
     }
 
-    calc_node_deps(sheet, node->left);
-    calc_node_deps(sheet, node->right);
+    calc_node_deps(sheet, node->left, out);
+    calc_node_deps(sheet, node->right, out);
 
     for (auto& arg : node->args) {
-        calc_node_deps(sheet, arg);
+        calc_node_deps(sheet, arg, out);
     }
 
     if (node->type == Node::Type::CELL_RANGE) {
         auto cells = evaluate_range(node);
         for (auto& cell_ref : cells) {
-            calc_node_deps(sheet, cell_ref);
+            calc_node_deps(sheet, cell_ref, out);
         }
     }
 }
 
 std::vector<std::shared_ptr<Cell>> Formula::calc_deps(std::shared_ptr<Sheet> sheet) {
+    deps.clear();
     if (!root) return deps;
-    calc_node_deps(sheet, root);
+    calc_node_deps(sheet, root, deps);
 
     return deps;
-}
\ No newline at end of file
+}
+
+void Formula::share_subexpressions(std::shared_ptr<Sheet> sheet) {
+    own_keys.clear();
+    if (!root) return;
+    // A shared formula must not look itself up again
+    share_node(sheet, root, !shared_root);
+}
+
+void Formula::release_subexpressions(std::shared_ptr<Sheet> sheet) {
+    for (auto& key : own_keys) {
+        sheet->release_expr_user(key, containing_cell);
+    }
+    own_keys.clear();
+}
+
+static bool has_range(const std::shared_ptr<Node>& node) {
+    if (!node) return false;
+    if (node->type == Node::Type::CELL_RANGE) return true;
+    if (has_range(node->left) || has_range(node->right)) return true;
+    for (auto& arg : node->args) {
+        if (has_range(arg)) return true;
+    }
+    return false;
+}
+
+// Functions over ranges are the expensive part, identical ones across formulas are evaluated once.
+// The first formula using one evaluates it in place, the sheet moves it into a shared cell for the second
+void Formula::share_node(std::shared_ptr<Sheet> sheet, std::shared_ptr<Node> node, bool allow) {
+    if (!node) return;
+
+    if (allow && node->type == Node::Type::FUNCTION && has_range(node)) {
+        std::vector<std::shared_ptr<Cell>> node_deps;
+        calc_node_deps(sheet, node, node_deps);
+
+        // Self references must keep reporting a circular ref
+        if (std::find(node_deps.begin(), node_deps.end(), containing_cell) == node_deps.end()) {
+            auto key = node_key(node);
+            node->shared = sheet->get_shared_expr(key, node, containing_cell);
+            if (node->shared) return;
+            own_keys.push_back(std::move(key));
+        }
+    }
+
+    share_node(sheet, node->left, true);
+    share_node(sheet, node->right, true);
+    for (auto& arg : node->args) {
+        share_node(sheet, arg, true);
+    }
+}
+
+std::string Formula::node_key(const std::shared_ptr<Node>& node) {
+    if (!node) return "?";
+
+    switch (node->type) {
+        case Node::Type::NUMBER:
+        case Node::Type::CELL_REF:
+        case Node::Type::CELL_RANGE:
+            return node->value;
+        case Node::Type::STRING:
+            return "\"" + node->value + "\"";
+        case Node::Type::FUNCTION: {
+            std::string key = node->value + "(";
+            for (size_t i = 0; i < node->args.size(); ++i) {
+                if (i > 0) key += ",";
+                key += node_key(node->args[i]);
+            }
+            return key + ")";
+        }
+        default:
+            return "(" + node_key(node->left) + node->value + node_key(node->right) + ")";
+    }
+}
+
+std::shared_ptr<Node> Formula::clone_node(const std::shared_ptr<Node>& node) {
+    if (!node) return nullptr;
+
+    auto copy = std::make_shared<Node>(node->type, node->value, clone_node(node->left), clone_node(node->right));
+    copy->criterion = node->criterion;
+    for (auto& arg : node->args) {
+        copy->args.push_back(clone_node(arg));
+    }
+    return copy;
+}
+
+static size_t node_memory(const std::shared_ptr<Node>& node) {
+    if (!node) return 0;
+
+    size_t bytes = sizeof(Node) + SHARED_PTR_OVERHEAD + heap_bytes(node->value) + heap_bytes(node->args);
+    if (node->criterion.has_value()) bytes += heap_bytes(node->criterion->text);
+
+    bytes += node_memory(node->left) + node_memory(node->right);
+    for (auto& arg : node->args) {
+        bytes += node_memory(arg);
+    }
+    return bytes;
+}
+
+size_t Formula::memory_usage() const {
+    size_t bytes = heap_bytes(text) + heap_bytes(err_msg) + heap_bytes(tokens) + heap_bytes(deps);
+    bytes += heap_bytes(own_keys);
+    for (auto& key : own_keys) {
+        bytes += heap_bytes(key);
+    }
+    for (auto& tok : tokens) {
+        bytes += heap_bytes(tok.value);
+    }
+    bytes += heap_bytes(spill.data);
+    return bytes + node_memory(root);
+}
@@ -2,6 +2,7 @@
 
 #include <functional>
 #include <memory>
+#include <optional>
 #include <string>
 #include <vector>
 
@@ -30,6 +31,35 @@ struct TokenData {
     std::string value;
 };
 
+// IF-family criterion such as ">=10", "<>done" or 3, compiled once and then
+// applied to whole ranges at a time
+struct Criterion {
+    enum class Op { EQ, NE, LT, LE, GT, GE } op = Op::EQ;
+    bool numeric = false;
+    double number = 0.0;
+    std::string text;
+
+    static Criterion compile(const std::string& raw);
+};
+
+// Values of a range read in one pass, numbers pre-parsed for the predicates
+struct RangeValues {
+    int cols = 0;
+    int rows = 0;
+    std::vector<std::string> text;
+    std::vector<double> numbers;
+    std::vector<char> is_number;
+
+    size_t size() const { return text.size(); }
+};
+
+// Result of an array expression, column-major like ranges
+struct ArrayValue {
+    int cols = 0;
+    int rows = 0;
+    std::vector<double> data;
+};
+
 struct Node {
     enum class Type {
         NUMBER,      // float
@@ -46,6 +76,8 @@ struct Node {
     std::shared_ptr<Node> left;
     std::shared_ptr<Node> right;
     std::vector<std::shared_ptr<Node>> args;
+    std::optional<Criterion> criterion;
+    std::shared_ptr<Cell> shared;  // cached result shared with other formulas
 
     Node(Type t, const std::string& val) : type(t), value(val) {}
 
@@ -56,16 +88,32 @@ struct Node {
 class Formula {
 public:
     explicit Formula(const std::shared_ptr<Cell>& cell, const std::string& expr);
+    // Already parsed subexpression, evaluated on behalf of the formulas sharing it
+    Formula(const std::shared_ptr<Cell>& cell, const std::string& key, const std::shared_ptr<Node>& node);
 
     std::string evaluate(std::shared_ptr<Sheet> sheet);
 
     std::vector<std::shared_ptr<Cell>> calc_deps(std::shared_ptr<Sheet> sheet);
+    void share_subexpressions(std::shared_ptr<Sheet> sheet);
+    // Lets go of the subexpressions this formula is the only user of
+    void release_subexpressions(std::shared_ptr<Sheet> sheet);
+
+    static std::string node_key(const std::shared_ptr<Node>& node);
+    static std::shared_ptr<Node> clone_node(const std::shared_ptr<Node>& node);
+
+    std::string get_text() const { return text; }
+    bool has_failed() const { return failed; }
+    // Bytes held by this formula outside of the object itself
+    size_t memory_usage() const;
 
-    std::string get_text() { return text; }
+    // Array formulas spill their result into the cells right and below
+    bool is_array() const;
+    const ArrayValue& get_spill() const { return spill; }
 
 private:
     std::string err_msg = "";
     bool failed = false;
+    bool shared_root = false;
     size_t current = 0;
 
     std::shared_ptr<Cell> containing_cell = nullptr;
@@ -74,6 +122,9 @@ private:
     std::shared_ptr<Node> root;
     std::vector<TokenData> tokens;
     std::vector<std::shared_ptr<Cell>> deps;
+    ArrayValue spill;
+    // Keys of range functions evaluated in place, until a second formula uses one of them
+    std::vector<std::string> own_keys;
 
     void parse(const std::string& expr);
     void tokenize(const std::string& expr);
@@ -82,13 +133,22 @@ private:
 
     std::string evaluate_node(std::shared_ptr<Sheet> sheet, std::shared_ptr<Node> node);
     std::string evaluate_func(std::shared_ptr<Sheet> sheet, std::shared_ptr<Node> node);
+    std::string evaluate_conditional_func(std::shared_ptr<Sheet> sheet, std::shared_ptr<Node> node);
+    bool fetch_range(std::shared_ptr<Sheet> sheet, std::shared_ptr<Node> node, RangeValues& out);
+    void apply_criterion(const Criterion& crit, const RangeValues& values, std::vector<char>& mask);
     std::string evaluate_binary_op(std::shared_ptr<Sheet> sheet, std::shared_ptr<Node> left,
                                    std::shared_ptr<Node> right, const std::function<double(double, double)>& op);
     std::vector<std::shared_ptr<Node>> evaluate_range(std::shared_ptr<Node> node);
+    bool evaluate_array(std::shared_ptr<Sheet> sheet, std::shared_ptr<Node> node, ArrayValue& out);
+    static bool is_array_node(const std::shared_ptr<Node>& node);
 
     std::shared_ptr<Node> parse_expression();
     std::shared_ptr<Node> parse_term();
     std::shared_ptr<Node> parse_factor();
+    void compile_criteria(std::shared_ptr<Node> func_node);
+    std::shared_ptr<Node> optimize(std::shared_ptr<Node> node);
+    bool is_constant(const std::shared_ptr<Node>& node) const;
+    void share_node(std::shared_ptr<Sheet> sheet, std::shared_ptr<Node> node, bool allow);
 
     bool match(std::initializer_list<Token> types);
     const TokenData& advance();
@@ -97,5 +157,6 @@ private:
     bool at_end() const;
     bool check(Token type) const;
 
-    void calc_node_deps(std::shared_ptr<Sheet> sheet, std::shared_ptr<Node> node);
+    void calc_node_deps(std::shared_ptr<Sheet> sheet, std::shared_ptr<Node> node,
+                        std::vector<std::shared_ptr<Cell>>& out);
 };
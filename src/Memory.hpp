@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Estimated heap footprint of a sheet, in bytes per category
+struct MemoryReport {
+    size_t cells = 0;     // Cell objects and the grid holding them
+    size_t values = 0;    // cached display strings
+    size_t strings = 0;   // interned text in the string pool
+    size_t formulas = 0;  // Formula objects, tokens and ASTs
+    size_t edges = 0;     // parents/children vectors
+    size_t spills = 0;    // spilled array results and spill bookkeeping
+
+    size_t populated_cells = 0;
+    size_t formula_count = 0;
+    size_t edge_count = 0;
+    size_t shared_exprs = 0;
+
+    size_t total() const { return cells + values + strings + formulas + edges + spills; }
+};
+
+// Reference count and deleter that make_shared/shared_ptr put next to (or in front of) the object
+constexpr size_t SHARED_PTR_OVERHEAD = 16;
+
+inline size_t heap_bytes(const std::string& str) {
+    // Short strings live inside the object itself
+    return str.capacity() > std::string().capacity() ? str.capacity() + 1 : 0;
+}
+
+template <typename T>
+size_t heap_bytes(const std::vector<T>& vec) {
+    return vec.capacity() * sizeof(T);
+}
@@ -0,0 +1,400 @@
+#include "Server.hpp"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Sheet.hpp"
+#include "Trace.hpp"
+
+// Little-endian reader over a request payload, every get fails once the payload runs out
+class Reader {
+public:
+    explicit Reader(const std::string& data) : data(data) {}
+
+    bool get_u16(uint16_t& out) {
+        if (pos + 2 > data.size()) return false;
+        out = static_cast<uint16_t>(byte(0) | byte(1) << 8);
+        pos += 2;
+        return true;
+    }
+
+    bool get_u32(uint32_t& out) {
+        if (pos + 4 > data.size()) return false;
+        out = byte(0) | byte(1) << 8 | byte(2) << 16 | byte(3) << 24;
+        pos += 4;
+        return true;
+    }
+
+    bool get_str(std::string& out) {
+        uint32_t len;
+        if (!get_u32(len) || len > data.size() - pos) return false;
+        out.assign(data, pos, len);
+        pos += len;
+        return true;
+    }
+
+private:
+    const std::string& data;
+    size_t pos = 0;
+
+    uint32_t byte(size_t i) const { return static_cast<uint8_t>(data[pos + i]); }
+};
+
+static uint32_t read_u32(const std::string& data, size_t pos) {
+    uint32_t v = 0;
+    for (int i = 0; i < 4; ++i) v |= static_cast<uint32_t>(static_cast<uint8_t>(data[pos + i])) << (8 * i);
+    return v;
+}
+
+static void put_u16(std::string& out, uint16_t v) {
+    out += static_cast<char>(v & 0xFF);
+    out += static_cast<char>(v >> 8);
+}
+
+static void put_u32(std::string& out, uint32_t v) {
+    for (int i = 0; i < 4; ++i) out += static_cast<char>((v >> (8 * i)) & 0xFF);
+}
+
+static void put_str(std::string& out, const std::string& str) {
+    put_u32(out, static_cast<uint32_t>(str.size()));
+    out += str;
+}
+
+// Frames are built in place, the length is patched in once the payload is known
+static size_t begin_frame(std::string& out, uint8_t op, uint32_t id) {
+    size_t start = out.size();
+    put_u32(out, 0);
+    out += static_cast<char>(op);
+    put_u32(out, id);
+    return start;
+}
+
+static void end_frame(std::string& out, size_t start) {
+    uint32_t len = static_cast<uint32_t>(out.size() - start - 4);
+    for (int i = 0; i < 4; ++i) out[start + i] = static_cast<char>((len >> (8 * i)) & 0xFF);
+}
+
+static void error_frame(std::string& out, uint32_t id, const std::string& message) {
+    size_t start = begin_frame(out, Server::ERROR, id);
+    put_str(out, message);
+    end_frame(out, start);
+}
+
+Server::Server(std::shared_ptr<Sheet> sheet, const std::string& socket_path) : sheet(sheet), path(socket_path) {}
+
+Server::~Server() {
+    for (auto& client : clients) close(client.fd);
+    if (listen_fd >= 0) {
+        close(listen_fd);
+        unlink(path.c_str());
+    }
+}
+
+bool Server::start() {
+    sockaddr_un addr{};
+    if (path.size() >= sizeof(addr.sun_path)) {
+        std::cerr << "Socket path too long: " << path << "\n";
+        return false;
+    }
+    addr.sun_family = AF_UNIX;
+    std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0) {
+        std::cerr << "socket: " << std::strerror(errno) << "\n";
+        return false;
+    }
+
+    // A socket file left behind by an earlier run would make bind fail
+    unlink(path.c_str());
+
+    if (bind(listen_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 || listen(listen_fd, 64) < 0) {
+        std::cerr << "bind " << path << ": " << std::strerror(errno) << "\n";
+        close(listen_fd);
+        listen_fd = -1;
+        return false;
+    }
+
+    fcntl(listen_fd, F_SETFL, O_NONBLOCK);
+    running = true;
+    return true;
+}
+
+void Server::run() {
+    std::vector<pollfd> fds;
+
+    while (running) {
+        fds.clear();
+        fds.push_back({listen_fd, POLLIN, 0});
+        bool backlog = false;
+        for (auto& client : clients) {
+            // Requests are left unread while replies pile up, the client has to catch up first
+            bool room = client.out.size() < OUTPUT_HIGH_WATER;
+            short events = room ? POLLIN : 0;
+            if (!client.out.empty()) events |= POLLOUT;
+            fds.push_back({client.fd, events, 0});
+            backlog = backlog || (room && client.held);
+        }
+
+        // Wake up now and then so stop() is noticed without a connection, right away when
+        // requests held back earlier can be handled
+        int ready = poll(fds.data(), fds.size(), backlog ? 0 : 200);
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            std::cerr << "poll: " << std::strerror(errno) << "\n";
+            return;
+        }
+
+        // Clients accepted below are only polled next round, fds lines up with the old list
+        size_t polled = clients.size();
+        std::vector<bool> keep(polled, true);
+
+        for (size_t i = 0; i < polled; ++i) {
+            auto& client = clients[i];
+            short revents = fds[i + 1].revents;
+            if (revents & (POLLERR | POLLNVAL)) {
+                keep[i] = false;
+                continue;
+            }
+
+            bool open = true;
+            if (revents & (POLLIN | POLLHUP)) open = read_client(client);
+            if (client.held || (revents & (POLLIN | POLLHUP))) keep[i] = handle_frames(client);
+
+            if (!open || !keep[i]) {
+                // Answer what was sent before the hangup or the broken frame, the socket may still be writable
+                write_client(client);
+                keep[i] = false;
+            }
+        }
+
+        // Requests of one round may have changed cells other clients subscribed to
+        for (size_t i = 0; i < polled; ++i) {
+            if (clients[i].overflowed) keep[i] = false;
+            if (keep[i] && !clients[i].out.empty()) keep[i] = write_client(clients[i]);
+        }
+
+        for (size_t i = polled; i-- > 0;) {
+            if (!keep[i]) {
+                close(clients[i].fd);
+                clients.erase(clients.begin() + i);
+            }
+        }
+
+        if (fds[0].revents & POLLIN) accept_clients();
+    }
+}
+
+void Server::accept_clients() {
+    while (true) {
+        int fd = accept(listen_fd, nullptr, nullptr);
+        if (fd < 0) return;
+
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+        clients.push_back({fd, "", "", {}});
+    }
+}
+
+bool Server::read_client(Client& client) {
+    char buf[65536];
+
+    // At most one more maximum frame is buffered, the rest stays in the socket
+    while (client.in.size() < MAX_FRAME + 4) {
+        ssize_t n = read(client.fd, buf, sizeof(buf));
+        if (n > 0) {
+            client.in.append(buf, n);
+            continue;
+        }
+        if (n == 0) return false;
+        return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+    }
+    return true;
+}
+
+bool Server::write_client(Client& client) {
+    while (!client.out.empty()) {
+        ssize_t n = send(client.fd, client.out.data(), client.out.size(), MSG_NOSIGNAL);
+        if (n > 0) {
+            client.out.erase(0, n);
+            continue;
+        }
+        return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR);
+    }
+    return true;
+}
+
+bool Server::handle_frames(Client& client) {
+    size_t pos = 0;
+    client.held = false;
+
+    // Everything that fully arrived is handled, the rest waits for the next read
+    while (client.in.size() - pos >= 4) {
+        if (client.out.size() >= OUTPUT_HIGH_WATER) {
+            client.held = true;
+            break;
+        }
+
+        uint32_t len = read_u32(client.in, pos);
+
+        if (len < 5 || len > MAX_FRAME) {
+            error_frame(client.out, 0, "Bad frame length " + std::to_string(len));
+            return false;
+        }
+        if (client.in.size() - pos - 4 < len) break;
+
+        uint8_t op = static_cast<uint8_t>(client.in[pos + 4]);
+        uint32_t id = read_u32(client.in, pos + 5);
+        std::string payload = client.in.substr(pos + 9, len - 5);
+        pos += 4 + len;
+
+        if (!handle_request(client, op, id, payload)) return false;
+    }
+
+    client.in.erase(0, pos);
+    return true;
+}
+
+bool Server::handle_request(Client& client, uint8_t op, uint32_t id, const std::string& payload) {
+    TraceSpan span("request", "server");
+    Reader req(payload);
+    uint32_t count;
+
+    if (op == GET) {
+        if (!req.get_u32(count) || count > payload.size() / 4) {
+            error_frame(client.out, id, "Malformed GET");
+            return true;
+        }
+
+        std::string body;
+        for (uint32_t i = 0; i < count; ++i) {
+            uint16_t col, row;
+            if (!req.get_u16(col) || !req.get_u16(row)) {
+                error_frame(client.out, id, "Malformed GET");
+                return true;
+            }
+            put_u16(body, col);
+            put_u16(body, row);
+            put_str(body, sheet->get_cell_val(col, row).value_or(""));
+        }
+
+        size_t start = begin_frame(client.out, GET_OK, id);
+        put_u32(client.out, count);
+        client.out += body;
+        end_frame(client.out, start);
+    } else if (op == SET) {
+        if (!req.get_u32(count)) {
+            error_frame(client.out, id, "Malformed SET");
+            return true;
+        }
+
+        // Decode the whole batch first so a malformed request changes nothing
+        struct Edit {
+            uint16_t col;
+            uint16_t row;
+            std::string value;
+        };
+        std::vector<Edit> edits;
+        for (uint32_t i = 0; i < count; ++i) {
+            Edit edit;
+            if (!req.get_u16(edit.col) || !req.get_u16(edit.row) || !req.get_str(edit.value)) {
+                error_frame(client.out, id, "Malformed SET");
+                return true;
+            }
+            edits.push_back(std::move(edit));
+        }
+
+        size_t start = begin_frame(client.out, SET_OK, id);
+        put_u32(client.out, count);
+        for (auto& edit : edits) {
+            client.out += static_cast<char>(sheet->set_cell(edit.col, edit.row, edit.value) ? 1 : 0);
+        }
+        end_frame(client.out, start);
+
+        // Array formulas the batch changed are evaluated once, not once per edit
+        sheet->flush_spills();
+        for (auto& other : clients) {
+            for (auto& sub : other.subscriptions) push_changes(other, sub);
+        }
+    } else if (op == SUBSCRIBE) {
+        uint16_t col, row, cols, rows;
+        if (!req.get_u16(col) || !req.get_u16(row) || !req.get_u16(cols) || !req.get_u16(rows)) {
+            error_frame(client.out, id, "Malformed SUBSCRIBE");
+            return true;
+        }
+
+        // Clamped to the sheet, nothing outside of it can change
+        Subscription sub{next_subscription++, col, row, 0, 0, {}};
+        sub.cols = std::max(0, std::min<int>(cols, Sheet::SHEET_COLS - col));
+        sub.rows = std::max(0, std::min<int>(rows, Sheet::SHEET_ROWS - row));
+        sub.last.assign(static_cast<size_t>(sub.cols) * sub.rows, "");
+
+        size_t start = begin_frame(client.out, SUB_OK, id);
+        put_u32(client.out, sub.id);
+        end_frame(client.out, start);
+
+        client.subscriptions.push_back(std::move(sub));
+        push_changes(client, client.subscriptions.back());
+    } else if (op == UNSUBSCRIBE) {
+        uint32_t sub_id;
+        if (!req.get_u32(sub_id)) {
+            error_frame(client.out, id, "Malformed UNSUBSCRIBE");
+            return true;
+        }
+
+        auto& subs = client.subscriptions;
+        subs.erase(std::remove_if(subs.begin(), subs.end(), [&](const Subscription& s) { return s.id == sub_id; }),
+                   subs.end());
+
+        size_t start = begin_frame(client.out, UNSUB_OK, id);
+        end_frame(client.out, start);
+    } else {
+        error_frame(client.out, id, "Unknown op " + std::to_string(op));
+    }
+
+    return true;
+}
+
+// The first push of a subscription compares against empty cells, so it carries every non-empty value
+void Server::push_changes(Client& client, Subscription& sub) {
+    if (client.overflowed) return;
+    if (client.out.size() >= MAX_OUTPUT) {
+        // A subscriber that stopped reading would otherwise grow the server without bound
+        client.overflowed = true;
+        return;
+    }
+
+    std::string body;
+    uint32_t changed = 0;
+
+    size_t i = 0;
+    for (int r = sub.row; r < sub.row + sub.rows; ++r) {
+        for (int c = sub.col; c < sub.col + sub.cols; ++c, ++i) {
+            auto val = sheet->get_cell_val(c, r).value_or("");
+            if (val == sub.last[i]) continue;
+
+            put_u16(body, static_cast<uint16_t>(c));
+            put_u16(body, static_cast<uint16_t>(r));
+            put_str(body, val);
+            sub.last[i] = std::move(val);
+            ++changed;
+        }
+    }
+
+    if (changed == 0) return;
+
+    size_t start = begin_frame(client.out, PUSH, sub.id);
+    put_u32(client.out, changed);
+    client.out += body;
+    end_frame(client.out, start);
+}
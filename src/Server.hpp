@@ -0,0 +1,93 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+class Sheet;
+
+// Serves one sheet to many clients over a Unix domain socket.
+//
+// Every message is a frame: u32 length of what follows, u8 op, u32 id, payload.
+// Integers are little-endian, strings are a u32 length followed by the bytes.
+// Requests are answered in order with the same id, so clients may pipeline them.
+//
+//   GET         u32 n, n * (u16 col, u16 row)             -> GET_OK  u32 n, n * (u16 col, u16 row, str value)
+//   SET         u32 n, n * (u16 col, u16 row, str value)  -> SET_OK  u32 n, n * u8 ok
+//   SUBSCRIBE   u16 col, u16 row, u16 cols, u16 rows      -> SUB_OK  u32 subscription
+//   UNSUBSCRIBE u32 subscription                          -> UNSUB_OK
+//   anything malformed                                    -> ERROR   str message
+//
+// A frame whose length is out of range gets an ERROR with id 0, then the connection is
+// closed since the stream cannot be resynchronised.
+//
+// After each SET every subscription gets a PUSH (id = subscription) with the cells
+// of its range that changed, in the GET_OK layout. A new subscription is pushed
+// its non-empty cells right away.
+//
+// A client that does not read its replies is not read from until it catches up, and a
+// subscriber whose unsent pushes pass MAX_OUTPUT is disconnected.
+class Server {
+public:
+    enum Op : uint8_t {
+        GET = 0x01,
+        SET = 0x02,
+        SUBSCRIBE = 0x03,
+        UNSUBSCRIBE = 0x04,
+        GET_OK = 0x81,
+        SET_OK = 0x82,
+        SUB_OK = 0x83,
+        UNSUB_OK = 0x84,
+        PUSH = 0x90,
+        ERROR = 0xFF
+    };
+
+    static constexpr uint32_t MAX_FRAME = 16 << 20;
+    static constexpr size_t OUTPUT_HIGH_WATER = 4 << 20;
+    static constexpr size_t MAX_OUTPUT = 64 << 20;
+
+    Server(std::shared_ptr<Sheet> sheet, const std::string& socket_path);
+    ~Server();
+
+    bool start();
+    // Blocks until stop() is called, safe to call stop() from a signal handler
+    void run();
+    void stop() { running = false; }
+
+private:
+    struct Subscription {
+        uint32_t id;
+        int col;
+        int row;
+        int cols;
+        int rows;
+        std::vector<std::string> last;
+    };
+
+    struct Client {
+        int fd;
+        std::string in;
+        std::string out;
+        std::vector<Subscription> subscriptions;
+        // Complete requests were left in `in` because the output passed OUTPUT_HIGH_WATER
+        bool held = false;
+        // Set once pushes overflowed MAX_OUTPUT, the client is dropped at the end of the round
+        bool overflowed = false;
+    };
+
+    std::shared_ptr<Sheet> sheet;
+    std::string path;
+    int listen_fd = -1;
+    std::atomic<bool> running{false};
+    uint32_t next_subscription = 1;
+    std::vector<Client> clients;
+
+    void accept_clients();
+    bool read_client(Client& client);
+    bool write_client(Client& client);
+    bool handle_frames(Client& client);
+    bool handle_request(Client& client, uint8_t op, uint32_t id, const std::string& payload);
+    void push_changes(Client& client, Subscription& sub);
+};
@@ -5,6 +5,8 @@
 #include <optional>
 
 #include "Cell.hpp"
+#include "Formula.hpp"
+#include "Trace.hpp"
 #include "Utils.hpp"
 
 Sheet::Sheet() {}
@@ -13,16 +15,45 @@ void Sheet::init_cells() {
     std::shared_ptr<Sheet> self = shared_from_this();
     for (int x = 0; x < SHEET_COLS; ++x) {
         for (int y = 0; y < SHEET_ROWS; ++y) {
-            cells[x][y] = std::make_unique<Cell>(self);
+            cells[x][y] = std::make_unique<Cell>(self, x, y);
         }
     }
 }
 
 bool Sheet::set_cell(int col, int row, const std::string& value) {
-    if (col >= 0 && col < SHEET_COLS && row >= 0 && row < SHEET_ROWS) {
-        cells[col][row]->set_value(value);
+    if (col < 0 || col >= SHEET_COLS || row < 0 || row >= SHEET_ROWS) return false;
+
+    TraceSpan span("set_cell", "sheet");
+    if (span.active()) span.set_arg(indices_to_cell_ref(col, row));
+
+    auto& cell = cells[col][row];
+    if (memory_budget == 0) {
+        cell->set_value(value);
         return true;
     }
+
+    // Remember what to put back, a spilled value comes back by clearing the cell. Typed values
+    // read back exactly as they were entered, so the raw value restores them without loss
+    std::string old;
+    if (auto formula = cell->get_formula()) {
+        old = *formula;
+    } else if (!cell->is_spilled()) {
+        old = cell->get_raw_value();
+    }
+
+    // Only what the edit allocates right away counts, other formulas are evaluated lazily.
+    // Spilling here costs an array evaluation per edit, but the budget has to see the spill
+    size_t before = memory_report().total();
+    cell->set_value(value);
+    flush_spills();
+
+    // Edits that do not grow the sheet always go through, a rolled back edit keeps the capacity it
+    // grew, and a sheet over its budget must still be editable to clean it up
+    size_t after = memory_report().total();
+    if (after <= memory_budget || after <= before) return true;
+
+    cell->set_value(old);
+    flush_spills();
     return false;
 }
 
@@ -47,6 +78,7 @@ std::shared_ptr<Cell> Sheet::get_cell(const std::string& cell_ref) {
 
 std::optional<std::string> Sheet::get_cell_val(int col, int row) {
     if (col >= 0 && col < SHEET_COLS && row >= 0 && row < SHEET_ROWS) {
+        flush_spills();
         return cells[col][row]->get_value();
     }
     return std::nullopt;
@@ -64,8 +96,103 @@ std::optional<std::string> Sheet::get_cell_formula(int col, int row) {
     }
     return std::nullopt;
 }
+
 std::optional<std::string> Sheet::get_cell_formula(const std::string& cell_ref) {
     auto indices = cell_ref_to_indices(cell_ref);
     if (!indices.has_value()) return std::nullopt;
     return get_cell_formula(indices->first, indices->second);
 }
+
+bool Sheet::set_cell_format(int col, int row, const std::string& spec) {
+    auto fmt = parse_number_format(spec);
+    if (!fmt.has_value() || col < 0 || col >= SHEET_COLS || row < 0 || row >= SHEET_ROWS) return false;
+    cells[col][row]->set_format(*fmt);
+    return true;
+}
+
+bool Sheet::set_cell_format(const std::string& cell_ref, const std::string& spec) {
+    auto indices = cell_ref_to_indices(cell_ref);
+    if (!indices.has_value()) return false;
+    return set_cell_format(indices->first, indices->second, spec);
+}
+
+void Sheet::flush_spills() {
+    if (pending_spills.empty()) return;
+    TraceSpan span("spill", "sheet");
+
+    while (!pending_spills.empty()) {
+        auto pending = std::move(pending_spills);
+        pending_spills.clear();
+        for (auto& cell : pending) {
+            cell->get_value();
+        }
+    }
+}
+
+MemoryReport Sheet::memory_report() const {
+    MemoryReport report;
+    report.cells = sizeof(Sheet);
+
+    for (auto& column : cells) {
+        for (auto& cell : column) {
+            if (cell) cell->add_memory(report);
+        }
+    }
+
+    report.shared_exprs = shared_exprs.size();
+    report.formulas += shared_exprs.bucket_count() * sizeof(void*);
+    for (auto& [key, cell] : shared_exprs) {
+        report.formulas += sizeof(decltype(shared_exprs)::value_type) + 2 * sizeof(void*) + heap_bytes(key);
+        cell->add_memory(report);
+    }
+    report.formulas += expr_users.bucket_count() * sizeof(void*);
+    for (auto& [key, cell] : expr_users) {
+        report.formulas += sizeof(decltype(expr_users)::value_type) + 2 * sizeof(void*) + heap_bytes(key);
+    }
+
+    report.spills += heap_bytes(pending_spills);
+    report.strings = string_pool.memory_usage();
+    return report;
+}
+
+std::shared_ptr<Cell> Sheet::get_shared_expr(const std::string& key, const std::shared_ptr<Node>& node,
+                                             const std::shared_ptr<Cell>& user) {
+    auto it = shared_exprs.find(key);
+    if (it != shared_exprs.end()) return it->second;
+
+    // A single user gains nothing from a hidden cell, only remember who it is
+    auto first = expr_users.find(key);
+    if (first == expr_users.end()) {
+        expr_users.emplace(key, user);
+        return nullptr;
+    }
+    if (first->second == user) return nullptr;
+
+    auto owner = first->second;
+    expr_users.erase(first);
+
+    auto cell = std::make_shared<Cell>(shared_from_this(), -1, -1);
+    shared_exprs.emplace(key, cell);
+    cell->set_shared_formula(key, Formula::clone_node(node));
+
+    // The first user switches over to the shared cell as well
+    owner->reattach_formula();
+    return cell;
+}
+
+void Sheet::release_shared_expr(const std::shared_ptr<Cell>& cell) {
+    auto key = cell->get_formula();
+    if (!key.has_value()) return;
+
+    auto it = shared_exprs.find(*key);
+    if (it == shared_exprs.end() || it->second != cell) return;
+
+    shared_exprs.erase(it);
+    cell->release_subexpressions();
+    cell->detach_parents();
+}
+
+void Sheet::release_expr_user(const std::string& key, const std::shared_ptr<Cell>& user) {
+    auto it = expr_users.find(key);
+    if (it != expr_users.end() && it->second == user) expr_users.erase(it);
+}
@@ -4,8 +4,14 @@
 #include <memory>
 #include <optional>
 #include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Memory.hpp"
+#include "StringPool.hpp"
 
 class Cell;
+struct Node;
 
 class Sheet : public std::enable_shared_from_this<Sheet> {
 public:
@@ -24,7 +30,34 @@ public:
     std::optional<std::string> get_cell_val(const std::string& cell_ref);
     std::optional<std::string> get_cell_formula(int col, int row);
     std::optional<std::string> get_cell_formula(const std::string& cell_ref);
+    bool set_cell_format(int col, int row, const std::string& spec);
+    bool set_cell_format(const std::string& cell_ref, const std::string& spec);
+
+    StringPool& strings() { return string_pool; }
+
+    MemoryReport memory_report() const;
+    // Edits that would grow the sheet past this many bytes are rolled back, 0 means no limit
+    void set_memory_budget(size_t bytes) { memory_budget = bytes; }
+    size_t get_memory_budget() const { return memory_budget; }
+
+    // Hidden cells holding subexpressions that several formulas have in common. The first user of a
+    // subexpression gets nullptr and evaluates it in place, the second one moves both onto a shared cell
+    std::shared_ptr<Cell> get_shared_expr(const std::string& key, const std::shared_ptr<Node>& node,
+                                          const std::shared_ptr<Cell>& user);
+    void release_shared_expr(const std::shared_ptr<Cell>& cell);
+    void release_expr_user(const std::string& key, const std::shared_ptr<Cell>& user);
+    size_t shared_expr_count() const { return shared_exprs.size(); }
+
+    // Array formulas changed by edits are evaluated once before the next read, so a batch of edits
+    // spills each of them once and their spilled cells can be read without them
+    void queue_spill(const std::shared_ptr<Cell>& cell) { pending_spills.push_back(cell); }
+    void flush_spills();
 
 private:
     std::array<std::array<std::shared_ptr<Cell>, SHEET_ROWS>, SHEET_COLS> cells;
+    std::unordered_map<std::string, std::shared_ptr<Cell>> shared_exprs;
+    std::unordered_map<std::string, std::shared_ptr<Cell>> expr_users;
+    std::vector<std::shared_ptr<Cell>> pending_spills;
+    StringPool string_pool;
+    size_t memory_budget = 0;
 };
@@ -1,9 +1,11 @@
 #include "Sheet_c_api.hpp"
 
 #include <memory>
+#include <sstream>
 #include <string>
 
 #include "Sheet.hpp"
+#include "Trace.hpp"
 
 extern "C" {
 
@@ -48,6 +50,58 @@ const char* sheet_get_cell_formula_ref(SheetHandle handle, const char* cell_ref)
     return tmp.c_str();
 }
 
+int sheet_set_cell_format(SheetHandle handle, int col, int row, const char* format) {
+    return static_cast<Sheet*>(handle)->set_cell_format(col, row, format);
+}
+
+int sheet_set_cell_format_ref(SheetHandle handle, const char* cell_ref, const char* format) {
+    return static_cast<Sheet*>(handle)->set_cell_format(cell_ref, format);
+}
+
+const char* sheet_get_range_vals(SheetHandle handle, int col, int row, int cols, int rows) {
+    auto* sheet = static_cast<Sheet*>(handle);
+    tmp.clear();
+    for (int r = row; r < row + rows; ++r) {
+        for (int c = col; c < col + cols; ++c) {
+            if (r != row || c != col) tmp += '\x1f';
+            tmp += sheet->get_cell_val(c, r).value_or("");
+        }
+    }
+    return tmp.c_str();
+}
+
+const char* sheet_memory_report(SheetHandle handle) {
+    auto report = static_cast<Sheet*>(handle)->memory_report();
+    auto per = [](size_t bytes, size_t count) { return count == 0 ? 0 : bytes / count; };
+
+    std::ostringstream ss;
+    ss << "total=" << report.total() << "\n"
+       << "cells=" << report.cells << "\n"
+       << "values=" << report.values << "\n"
+       << "strings=" << report.strings << "\n"
+       << "formulas=" << report.formulas << "\n"
+       << "edges=" << report.edges << "\n"
+       << "spills=" << report.spills << "\n"
+       << "populated_cells=" << report.populated_cells << "\n"
+       << "formula_count=" << report.formula_count << "\n"
+       << "edge_count=" << report.edge_count << "\n"
+       << "shared_exprs=" << report.shared_exprs << "\n"
+       << "bytes_per_cell=" << per(report.total(), report.populated_cells) << "\n"
+       << "bytes_per_formula=" << per(report.formulas, report.formula_count) << "\n"
+       << "bytes_per_edge=" << per(report.edges, report.edge_count) << "\n"
+       << "budget=" << static_cast<Sheet*>(handle)->get_memory_budget() << "\n";
+    tmp = ss.str();
+    return tmp.c_str();
+}
+
+void sheet_set_memory_budget(SheetHandle handle, unsigned long long bytes) {
+    static_cast<Sheet*>(handle)->set_memory_budget(bytes);
+}
+
+void sheet_trace_start() { trace_start(); }
+void sheet_trace_stop() { trace_stop(); }
+int sheet_trace_write(const char* path) { return trace_write(path); }
+
 int sheet_cols(SheetHandle handle) { return static_cast<Sheet*>(handle)->SHEET_COLS; }
 int sheet_rows(SheetHandle handle) { return static_cast<Sheet*>(handle)->SHEET_ROWS; }
 }
\ No newline at end of file
@@ -15,6 +15,23 @@ const char* sheet_get_cell_val_ref(SheetHandle sheet, const char* cell_ref);
 const char* sheet_get_cell_formula(SheetHandle sheet, int col, int row);
 const char* sheet_get_cell_formula_ref(SheetHandle sheet, const char* cell_ref);
 
+// "general", "fixed:N", "percent:N" or "sci:N"
+int sheet_set_cell_format(SheetHandle sheet, int col, int row, const char* format);
+int sheet_set_cell_format_ref(SheetHandle sheet, const char* cell_ref, const char* format);
+
+// Values of a rectangle, row by row, separated by '\x1f' (unit separator)
+const char* sheet_get_range_vals(SheetHandle sheet, int col, int row, int cols, int rows);
+
+// "key=value" lines: bytes per category, counts and bytes per cell, formula and edge
+const char* sheet_memory_report(SheetHandle sheet);
+// Edits that would exceed the budget are rejected (set_cell returns 0), 0 disables it
+void sheet_set_memory_budget(SheetHandle sheet, unsigned long long bytes);
+
+// Recalc tracing, written as Chrome trace-event JSON
+void sheet_trace_start();
+void sheet_trace_stop();
+int sheet_trace_write(const char* path);
+
 int sheet_cols(SheetHandle sheet);
 int sheet_rows(SheetHandle sheet);
 }
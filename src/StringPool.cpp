@@ -0,0 +1,31 @@
+#include "StringPool.hpp"
+
+#include <string>
+
+#include "Memory.hpp"
+
+const std::string* StringPool::intern(const std::string& str) {
+    auto [it, inserted] = refs.try_emplace(str, 0);
+    ++it->second;
+    return &it->first;
+}
+
+void StringPool::release(const std::string* str) {
+    if (str == nullptr) return;
+
+    auto it = refs.find(*str);
+    if (it == refs.end()) return;
+
+    if (--it->second == 0) {
+        refs.erase(it);
+    }
+}
+
+size_t StringPool::memory_usage() const {
+    // Every entry is a hash node with a next pointer and the cached hash next to the pair
+    size_t bytes = refs.bucket_count() * sizeof(void*);
+    for (auto& [str, count] : refs) {
+        bytes += sizeof(decltype(refs)::value_type) + 2 * sizeof(void*) + heap_bytes(str);
+    }
+    return bytes;
+}
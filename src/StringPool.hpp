@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <unordered_map>
+
+// Sheet wide store of text values, repeated labels are kept once and shared by pointer
+class StringPool {
+public:
+    const std::string* intern(const std::string& str);
+    void release(const std::string* str);
+
+    size_t size() const { return refs.size(); }
+    size_t memory_usage() const;
+
+private:
+    // Keys of an unordered_map never move, so pointers to them stay valid
+    std::unordered_map<std::string, size_t> refs;
+};
@@ -0,0 +1,143 @@
+#include "Trace.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+std::atomic<bool> trace_on{false};
+
+static constexpr size_t TRACE_ARG_LEN = 40;
+static constexpr size_t TRACE_CAPACITY = 1 << 16;
+
+struct TraceEvent {
+    const char* name;
+    const char* cat;
+    int64_t start_ns;
+    int64_t end_ns;
+    char arg[TRACE_ARG_LEN];
+};
+
+// Written only by its own thread, the newest TRACE_CAPACITY spans are kept
+struct TraceBuffer {
+    std::array<TraceEvent, TRACE_CAPACITY> events;
+    std::atomic<uint64_t> head{0};
+    int tid = 0;
+};
+
+static std::atomic<int64_t> trace_epoch_ns{0};
+
+// Only taken when a thread records its first span and when writing
+static std::mutex registry_mutex;
+static std::vector<std::unique_ptr<TraceBuffer>> registry;
+
+static thread_local TraceBuffer* local_buffer = nullptr;
+
+int64_t trace_now_ns() {
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+}
+
+static TraceBuffer* thread_buffer() {
+    if (local_buffer == nullptr) {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        // Default-initialized on purpose, zeroing the events up front would show up in the trace
+        registry.push_back(std::unique_ptr<TraceBuffer>(new TraceBuffer));
+        registry.back()->tid = static_cast<int>(registry.size());
+        local_buffer = registry.back().get();
+    }
+    return local_buffer;
+}
+
+void trace_start() {
+    thread_buffer();
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        for (auto& buffer : registry) {
+            buffer->head.store(0, std::memory_order_relaxed);
+        }
+    }
+    trace_epoch_ns.store(trace_now_ns(), std::memory_order_relaxed);
+    trace_on.store(true, std::memory_order_release);
+}
+
+void trace_stop() { trace_on.store(false, std::memory_order_release); }
+
+void trace_record(const char* name, const char* cat, int64_t start_ns, int64_t end_ns, const std::string& arg) {
+    TraceBuffer* buffer = thread_buffer();
+    uint64_t head = buffer->head.load(std::memory_order_relaxed);
+
+    TraceEvent& event = buffer->events[head % TRACE_CAPACITY];
+    event.name = name;
+    event.cat = cat;
+    event.start_ns = start_ns;
+    event.end_ns = end_ns;
+    size_t len = std::min(arg.size(), TRACE_ARG_LEN - 1);
+    arg.copy(event.arg, len);
+    event.arg[len] = '\0';
+
+    buffer->head.store(head + 1, std::memory_order_release);
+}
+
+static void write_json_string(std::ofstream& out, const char* str) {
+    out << '"';
+    for (const char* c = str; *c != '\0'; ++c) {
+        if (*c == '"' || *c == '\\') {
+            out << '\\' << *c;
+        } else if (static_cast<unsigned char>(*c) < 0x20) {
+            char esc[8];
+            std::snprintf(esc, sizeof(esc), "\\u%04x", *c);
+            out << esc;
+        } else {
+            out << *c;
+        }
+    }
+    out << '"';
+}
+
+bool trace_write(const std::string& path) {
+    std::ofstream out(path);
+    if (!out) return false;
+
+    int64_t epoch = trace_epoch_ns.load(std::memory_order_relaxed);
+    bool first = true;
+    char num[64];
+
+    out << "{\"traceEvents\":[\n";
+
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    for (auto& buffer : registry) {
+        uint64_t head = buffer->head.load(std::memory_order_acquire);
+        uint64_t begin = head > TRACE_CAPACITY ? head - TRACE_CAPACITY : 0;
+
+        for (uint64_t i = begin; i < head; ++i) {
+            const TraceEvent& event = buffer->events[i % TRACE_CAPACITY];
+            if (!first) out << ",\n";
+            first = false;
+
+            // Timestamps and durations are in microseconds
+            out << "{\"name\":";
+            write_json_string(out, event.name);
+            out << ",\"cat\":";
+            write_json_string(out, event.cat);
+            std::snprintf(num, sizeof(num), ",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f",
+                          (event.start_ns - epoch) / 1000.0, (event.end_ns - event.start_ns) / 1000.0);
+            out << num << ",\"pid\":1,\"tid\":" << buffer->tid;
+            if (event.arg[0] != '\0') {
+                out << ",\"args\":{\"detail\":";
+                write_json_string(out, event.arg);
+                out << "}";
+            }
+            out << "}";
+        }
+    }
+
+    out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+    return static_cast<bool>(out);
+}
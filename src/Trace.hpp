@@ -0,0 +1,46 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+// Opt-in recalc tracing. Spans go into a per-thread ring buffer without locking and
+// are written out in Chrome trace-event format (chrome://tracing, Perfetto).
+
+extern std::atomic<bool> trace_on;
+
+inline bool trace_enabled() { return trace_on.load(std::memory_order_relaxed); }
+
+// Clears earlier spans and starts recording
+void trace_start();
+void trace_stop();
+// Call between recalcs, spans recorded while writing may be torn
+bool trace_write(const std::string& path);
+
+void trace_record(const char* name, const char* cat, int64_t start_ns, int64_t end_ns, const std::string& arg);
+int64_t trace_now_ns();
+
+// Records the time between construction and destruction, costs one relaxed load when tracing is off
+class TraceSpan {
+public:
+    TraceSpan(const char* name, const char* cat) : name(name), cat(cat), on(trace_enabled()) {
+        if (on) start_ns = trace_now_ns();
+    }
+    ~TraceSpan() {
+        if (on) trace_record(name, cat, start_ns, trace_now_ns(), arg);
+    }
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+    bool active() const { return on; }
+    void set_arg(const std::string& val) { arg = val; }
+
+private:
+    const char* name;
+    const char* cat;
+    bool on;
+    int64_t start_ns = 0;
+    std::string arg;
+};
@@ -1,23 +1,67 @@
 #include "Utils.hpp"
 
 #include <charconv>
-#include <iomanip>
-#include <ios>
+#include <cmath>
 #include <iostream>
 #include <optional>
 
-std::string pretty_print_double(double d) {
-    std::ostringstream ss;
-    ss << std::fixed << std::setprecision(10) << d;
-    std::string s = ss.str();
+static std::string print_double(double d, std::chars_format fmt, int precision) {
+    // Largest double in fixed notation is 309 digits, precision is capped at 20
+    char buf[400];
+    auto [ptr, ec] = std::to_chars(buf, buf + sizeof(buf), d, fmt, precision);
+    if (ec != std::errc()) return "";
+    return std::string(buf, ptr);
+}
 
-    s.erase(s.find_last_not_of('0') + 1, std::string::npos);
+std::string pretty_print_double(double d) {
+    std::string s = print_double(d, std::chars_format::fixed, 10);
 
-    if (!s.empty() && s.back() == '.') s.pop_back();
+    if (s.find('.') != std::string::npos) {
+        s.erase(s.find_last_not_of('0') + 1, std::string::npos);
+        if (!s.empty() && s.back() == '.') s.pop_back();
+    }
 
     return s;
 }
 
+std::string format_number(double d, const NumberFormat& fmt) {
+    switch (fmt.kind) {
+        case NumberFormat::Kind::FIXED:
+            return print_double(d, std::chars_format::fixed, fmt.decimals);
+        case NumberFormat::Kind::PERCENT:
+            return print_double(d * 100.0, std::chars_format::fixed, fmt.decimals) + "%";
+        case NumberFormat::Kind::SCIENTIFIC:
+            return print_double(d, std::chars_format::scientific, fmt.decimals);
+        default:
+            return pretty_print_double(d);
+    }
+}
+
+std::optional<NumberFormat> parse_number_format(const std::string& spec) {
+    NumberFormat fmt;
+    auto delim_pos = spec.find(':');
+    std::string kind = spec.substr(0, delim_pos);
+
+    if (kind == "general" || kind.empty()) {
+        return fmt;
+    } else if (kind == "fixed") {
+        fmt.kind = NumberFormat::Kind::FIXED;
+    } else if (kind == "percent") {
+        fmt.kind = NumberFormat::Kind::PERCENT;
+    } else if (kind == "sci") {
+        fmt.kind = NumberFormat::Kind::SCIENTIFIC;
+    } else {
+        return std::nullopt;
+    }
+
+    if (delim_pos != std::string::npos) {
+        if (!parse_int(spec.substr(delim_pos + 1), fmt.decimals)) return std::nullopt;
+        if (fmt.decimals < 0 || fmt.decimals > 20) return std::nullopt;
+    }
+
+    return fmt;
+}
+
 bool parse_double(const std::string& str, double& out) {
     auto [ptr, ec] = std::from_chars(str.data(), str.data() + str.size(), out);
     if (ec != std::errc()) {
@@ -26,6 +70,13 @@ bool parse_double(const std::string& str, double& out) {
     return true;
 }
 
+// Strict version of parse_double: the whole string must be a finite number
+bool parse_number(const std::string& str, double& out) {
+    const char* end = str.data() + str.size();
+    auto [ptr, ec] = std::from_chars(str.data(), end, out);
+    return ec == std::errc() && ptr == end && std::isfinite(out);
+}
+
 bool parse_int(const std::string& str, int& out) {
     auto [ptr, ec] = std::from_chars(str.data(), str.data() + str.size(), out);
     if (ec != std::errc()) {
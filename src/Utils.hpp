@@ -3,8 +3,17 @@
 #include <optional>
 #include <string>
 
+// How a cell displays its number, written as "general", "fixed:2", "percent:1" or "sci:3"
+struct NumberFormat {
+    enum class Kind { GENERAL, FIXED, PERCENT, SCIENTIFIC } kind = Kind::GENERAL;
+    int decimals = 0;
+};
+
 std::string pretty_print_double(double d);
+std::string format_number(double d, const NumberFormat& fmt);
+std::optional<NumberFormat> parse_number_format(const std::string& spec);
 bool parse_double(const std::string& str, double& out);
+bool parse_number(const std::string& str, double& out);
 bool parse_int(const std::string& str, int& out);
 std::optional<std::pair<int, int>> cell_ref_to_indices(const std::string& cell_ref);
-std::string indices_to_cell_ref(int x, int y);
\ No newline at end of file
+std::string indices_to_cell_ref(int x, int y);